@@ -0,0 +1,78 @@
+#pragma once
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "Config.h"
+#include "Metrics.h"
+#include "ProcessInventory.h"
+
+// Platform side of the configured actions: launching processes and closing them.
+class action_backend {
+public:
+    virtual ~action_backend() = default;
+
+    // Replaces what start() launches, as executable paths with their space-separated arguments
+    virtual void set_start_entries(const std::vector<std::pair<std::string, std::string>>& entries) = 0;
+
+    // Launches every entry that is not running yet, without waiting on what was launched
+    virtual void start() = 0;
+
+    // Asks the processes to close and terminates whatever is still running once the grace period is over. A
+    // backend may finish this in the background once the processes were asked to close. pids is sorted.
+    virtual void kill(const std::vector<uint32_t>& pids, std::chrono::milliseconds grace) = 0;
+
+    // Receive the duration of every launch round and of every kill, up to the last process being gone
+    virtual void set_start_histogram(metrics_registry::histogram* /*histogram*/) {}
+    virtual void set_kill_histogram(metrics_registry::histogram* /*histogram*/) {}
+};
+
+// Runs the configured actions when the presence rule's result flips. Which processes are affected is decided
+// here, from the process inventory; the backend only acts on them.
+class action_engine {
+public:
+    action_engine(process_selector& selector, std::unique_ptr<action_backend> backend)
+        : selector_(selector), backend_(std::move(backend)) {}
+
+    action_engine(const action_engine&) = delete;
+    action_engine& operator=(const action_engine&) = delete;
+
+    void set_metrics(metrics_registry::histogram* start_time, metrics_registry::histogram* kill_time) {
+        backend_->set_start_histogram(start_time);
+        backend_->set_kill_histogram(kill_time);
+    }
+
+    void set_start_entries(const std::vector<std::pair<std::string, std::string>>& entries) {
+        backend_->set_start_entries(entries);
+    }
+
+    // From now on nothing is launched, and kills give up on their grace period at the deadline
+    void begin_teardown(std::chrono::steady_clock::time_point deadline) {
+        teardown_deadline_ = deadline;
+    }
+
+    void on_presence_change(const config& cfg, bool present) {
+        bool tearing_down = teardown_deadline_ != std::chrono::steady_clock::time_point::max();
+        if(!cfg.start_processes.empty() && present) {
+            if(!tearing_down)
+                backend_->start();
+        } else if(!cfg.kill_matcher.empty() && !present) {
+            auto grace = cfg.kill_grace_period;
+            if(tearing_down)
+                grace = std::clamp(std::chrono::duration_cast<std::chrono::milliseconds>(teardown_deadline_ - std::chrono::steady_clock::now()),
+                                   std::chrono::milliseconds::zero(), grace);
+            auto pids = selector_.select(cfg.kill_matcher, cfg.kill_process_tree);
+            if(!pids.empty())
+                backend_->kill(pids, grace);
+        }
+    }
+
+private:
+    process_selector& selector_;
+    std::unique_ptr<action_backend> backend_;
+    std::chrono::steady_clock::time_point teardown_deadline_ = std::chrono::steady_clock::time_point::max();
+};
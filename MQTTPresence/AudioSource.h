@@ -0,0 +1,31 @@
+#pragma once
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+struct audio_session_sample {
+    uint32_t pid;
+    uint64_t start_time; // process creation time, captured once per session
+    float peak;
+};
+
+// A source of audio sessions whose session list is maintained out of band (e.g. from notifications),
+// so that sampling only has to read the current meters.
+class audio_source {
+public:
+    virtual ~audio_source() = default;
+
+    // Replaces the contents of out with every live session. Inactive sessions report a peak of zero.
+    virtual void sample(std::vector<audio_session_sample>& out) = 0;
+
+    // Resolves the full image path of a process (e.g. "C:\Program Files\Mozilla Firefox\firefox.exe").
+    virtual bool process_path(uint32_t pid, std::wstring& out) = 0;
+
+    // Whether no session can currently be producing sound, so reading the meters can be skipped. Sources that
+    // cannot tell are never idle.
+    virtual bool idle() { return false; }
+
+    // Sources that report idle() call this, from any thread, when a session may have started playing.
+    virtual void set_wake_handler(std::function<void()> /*handler*/) {}
+};
@@ -0,0 +1,29 @@
+#pragma once
+#include <algorithm>
+#include <chrono>
+#include <random>
+
+// Exponential backoff with equal jitter: each delay is drawn from the upper half of the current step, so
+// clients that lost the same broker do not all retry at once.
+class jittered_backoff {
+public:
+    jittered_backoff(std::chrono::milliseconds initial, std::chrono::milliseconds max)
+        : initial_(std::max(initial, std::chrono::milliseconds(1))), max_(std::max(max, initial_)), step_(initial_)
+        , rng_(std::random_device {}()) {}
+
+    std::chrono::milliseconds next() {
+        auto step = step_;
+        step_ = std::min(step_ * 2, max_);
+
+        std::uniform_int_distribution<long long> dist(step.count() / 2, step.count());
+        return std::chrono::milliseconds(dist(rng_));
+    }
+
+    void reset() {
+        step_ = initial_;
+    }
+
+private:
+    std::chrono::milliseconds initial_, max_, step_;
+    std::mt19937 rng_;
+};
@@ -0,0 +1,192 @@
+#pragma once
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <nlohmann/json.hpp>
+
+#include "MQTTPresence.h"
+#include "ProcessMatcher.h"
+#include "PublishPolicy.h"
+#include "SoundSampler.h"
+
+// Immutable snapshot of config.json. A reload parses a new snapshot, diffs it against the running one
+// and only re-applies the sections that actually changed.
+struct config {
+    // MQTT
+    std::string mqtt_host = "localhost", mqtt_port = "1883", mqtt_topic = "winmqttpresence", mqtt_username, mqtt_password;
+    int mqtt_keep_alive = 60, state_refresh_interval = 0, diagnostics_interval = 60;
+    publish_policy_table publish_policies = default_publish_policies();
+    bool consolidated_state = false;
+
+    // Volume
+    bool enable_volume = true, volume_check_all_devices = false;
+    std::vector<std::string> volume_processes;
+    process_matcher volume_matcher;
+    sound_sampler_settings sound_sampling;
+
+    // Activity
+    bool enable_activity = true;
+
+    // Presence
+    std::string presence_rule;
+
+    // Kill
+    std::vector<std::string> kill_processes;
+    process_matcher kill_matcher;
+    std::chrono::milliseconds kill_grace_period { 1000 };
+    bool kill_process_tree = false;
+
+    // Start
+    std::vector<std::pair<std::string, std::string>> start_processes;
+};
+
+enum config_section : unsigned {
+    CONFIG_NONE = 0,
+    CONFIG_MQTT = 1 << 0,
+    CONFIG_VOLUME = 1 << 1,           // the volume check has to be rebuilt
+    CONFIG_VOLUME_PROCESSES = 1 << 2, // only the volume matcher changed
+    CONFIG_ACTIVITY = 1 << 3,
+    CONFIG_KILL = 1 << 4,
+    CONFIG_START = 1 << 5,
+    CONFIG_SOUND_SAMPLING = 1 << 6,
+    CONFIG_PRESENCE = 1 << 7
+};
+
+inline std::vector<std::string> parse_string_list(const nlohmann::json& cfg, const char* key) {
+    std::vector<std::string> out;
+    if (cfg.contains(key)) {
+        const auto& list = cfg[key];
+        if (list.is_array()) {
+            for (const auto& item : list) {
+                if (item.is_string())
+                    out.push_back(item);
+            }
+        }
+    }
+    return out;
+}
+
+inline process_matcher build_matcher(const std::vector<std::string>& patterns) {
+    process_matcher m;
+    for (const auto& p : patterns)
+        m.add(s2ws(p));
+    return m;
+}
+
+inline std::shared_ptr<const config> parse_config(const nlohmann::json& cfg) {
+    auto out = std::make_shared<config>();
+
+    out->mqtt_host = cfg.value("mqttHost", "localhost");
+    out->mqtt_port = std::to_string(cfg.value("mqttPort", 1883));
+    out->mqtt_topic = cfg.value("mqttTopic", "winmqttpresence");
+    out->mqtt_username = cfg.value("mqttUsername", "");
+    out->mqtt_password = cfg.value("mqttPassword", "");
+    out->mqtt_keep_alive = cfg.value("mqttKeepAlive", 60);
+    out->state_refresh_interval = cfg.value("stateRefreshInterval", 0);
+    out->diagnostics_interval = cfg.value("diagnosticsInterval", 60);
+    out->consolidated_state = cfg.value("consolidatedState", false);
+
+    if (cfg.contains("publishPolicy")) {
+        const auto& policies = cfg["publishPolicy"];
+        if (policies.is_object()) {
+            for (size_t i = 0; i < out->publish_policies.size(); i++) {
+                const char* name = message_class_name(static_cast<message_class>(i));
+                if (!policies.contains(name) || !policies[name].is_object())
+                    continue;
+
+                const auto& policy = policies[name];
+                auto& p = out->publish_policies[i];
+                p.qos = std::clamp(policy.value("qos", p.qos), 0, 2);
+                p.retain = policy.value("retain", p.retain);
+                p.expiry = static_cast<uint32_t>(std::max(0, policy.value("expiry", static_cast<int>(p.expiry))));
+            }
+        }
+    }
+
+    out->enable_volume = cfg.value("enableVolumeCheck", true);
+    out->volume_check_all_devices = cfg.value("enableVolumeCheckAllDevices", false);
+    out->volume_processes = parse_string_list(cfg, "volumeProcesses");
+    out->volume_matcher = build_matcher(out->volume_processes);
+
+    auto& sampling = out->sound_sampling;
+    sampling.on_delay = std::chrono::milliseconds(cfg.value("soundOnDelay", sampling.on_delay.count()));
+    sampling.off_delay = std::chrono::milliseconds(cfg.value("soundOffDelay", sampling.off_delay.count()));
+    sampling.fast_interval = std::chrono::milliseconds(cfg.value("soundPollFast", sampling.fast_interval.count()));
+    sampling.slow_interval = std::chrono::milliseconds(cfg.value("soundPollSlow", sampling.slow_interval.count()));
+    sampling.sample_interval = std::chrono::milliseconds(cfg.value("soundSampleInterval", sampling.sample_interval.count()));
+
+    out->enable_activity = cfg.value("enableActivityCheck", true);
+
+    out->presence_rule = cfg.value("presenceRule", "");
+
+    out->kill_processes = parse_string_list(cfg, "killProcesses");
+    out->kill_matcher = build_matcher(out->kill_processes);
+    out->kill_grace_period = std::chrono::milliseconds(cfg.value("killGracePeriod", 1000));
+    out->kill_process_tree = cfg.value("killProcessTree", false);
+
+    if (cfg.contains("startProcesses")) {
+        const auto& processes = cfg["startProcesses"];
+        if (processes.is_array()) {
+            for (const auto& proc : processes) {
+                if (proc.is_string())
+                    out->start_processes.push_back(std::make_pair(proc, std::string()));
+                else if (proc.is_array())
+                {
+                    std::string app;
+                    std::string args;
+                    for (const auto& element : proc) {
+                        if (app.empty())
+                            app = element;
+                        else if (args.empty())
+                            args = element;
+                        else {
+                            args += ' ';
+                            args += element.get<std::string>();
+                        }
+                    }
+
+                    out->start_processes.push_back(std::make_pair(app, args));
+                }
+            }
+        }
+    }
+
+    return out;
+}
+
+inline unsigned diff_config(const config& a, const config& b) {
+    unsigned changed = CONFIG_NONE;
+
+    if (a.mqtt_host != b.mqtt_host || a.mqtt_port != b.mqtt_port || a.mqtt_topic != b.mqtt_topic
+     || a.mqtt_username != b.mqtt_username || a.mqtt_password != b.mqtt_password
+     || a.mqtt_keep_alive != b.mqtt_keep_alive || a.state_refresh_interval != b.state_refresh_interval
+     || a.diagnostics_interval != b.diagnostics_interval || a.consolidated_state != b.consolidated_state
+     || a.publish_policies != b.publish_policies)
+        changed |= CONFIG_MQTT;
+
+    if (a.enable_volume != b.enable_volume || a.volume_check_all_devices != b.volume_check_all_devices)
+        changed |= CONFIG_VOLUME;
+    else if (a.volume_processes != b.volume_processes)
+        changed |= CONFIG_VOLUME_PROCESSES;
+
+    if (a.sound_sampling != b.sound_sampling)
+        changed |= CONFIG_SOUND_SAMPLING;
+
+    if (a.enable_activity != b.enable_activity)
+        changed |= CONFIG_ACTIVITY;
+
+    if (a.presence_rule != b.presence_rule)
+        changed |= CONFIG_PRESENCE;
+
+    if (a.kill_processes != b.kill_processes || a.kill_grace_period != b.kill_grace_period || a.kill_process_tree != b.kill_process_tree)
+        changed |= CONFIG_KILL;
+
+    if (a.start_processes != b.start_processes)
+        changed |= CONFIG_START;
+
+    return changed;
+}
@@ -0,0 +1,138 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include <nlohmann/json.hpp>
+
+// Home Assistant discovery configs for one device, generated once and fingerprinted. On connect the broker's
+// retained copies are fed to seen(), and only the entries it does not already hold verbatim are published, so a
+// fleet reconnecting after a broker restart does not make Home Assistant reprocess every entity. Retained configs
+// under this device that are no longer part of the set, e.g. after switching to the consolidated state document or
+// dropping a metric, are collected too, so they can be cleared.
+class discovery_set {
+public:
+    struct entry {
+        std::string topic;
+        std::string payload;
+        uint64_t hash;
+        bool retained = false; // the broker holds exactly this payload
+    };
+
+    struct stats {
+        uint64_t published;
+        uint64_t skipped;
+    };
+
+    explicit discovery_set(std::string device) : device_(std::move(device)) {}
+
+    // A binary sensor with its own state topic, or with its field in a shared JSON state document
+    void add_binary_sensor(const std::string& key, const std::string& state_topic, const char* device_class, bool in_document = false) {
+        auto cfg = common(key);
+        cfg["stat_t"] = state_topic;
+        cfg["dev_cla"] = device_class;
+        if(in_document) {
+            cfg["val_tpl"] = "{{ value_json." + key + " }}";
+            cfg["json_attr_t"] = state_topic;
+        }
+        add("homeassistant/binary_sensor/" + device_ + "/" + key + "/config", cfg);
+    }
+
+    // A diagnostic sensor reading its field out of a shared JSON payload
+    void add_diagnostic(const std::string& key, const std::string& state_topic, const char* unit) {
+        auto cfg = common(key);
+        cfg["stat_t"] = state_topic;
+        cfg["val_tpl"] = "{{ value_json." + key + " }}";
+        cfg["ent_cat"] = "diagnostic";
+        if(*unit)
+            cfg["unit_of_meas"] = unit;
+        add("homeassistant/sensor/" + device_ + "/" + key + "/config", cfg);
+    }
+
+    // Forgets what the broker held, before its retained copies are fed in again
+    void reset() {
+        for(auto& e : entries_)
+            e.retained = false;
+        stale_.clear();
+    }
+
+    // Returns whether the topic is one of ours. A non-empty config under this device that is not is kept as stale.
+    bool seen(const std::string& topic, std::string_view payload) {
+        auto it = index_.find(topic);
+        if(it == index_.end()) {
+            if(!payload.empty() && owned(topic))
+                stale_.push_back(topic);
+            return false;
+        }
+
+        auto& e = entries_[it->second];
+        e.retained = payload.size() == e.payload.size() && fnv1a(payload) == e.hash;
+        return true;
+    }
+
+    // Calls fn for every entry the broker does not hold, and counts the rest as skipped
+    template <typename Fn>
+    void for_each_changed(Fn&& fn) {
+        for(const auto& e : entries_) {
+            if(e.retained) {
+                skipped_++;
+                continue;
+            }
+
+            fn(e);
+            published_++;
+        }
+    }
+
+    // Retained config topics under this device seen since the last reset() that no entry publishes any more
+    [[nodiscard]] const std::vector<std::string>& stale() const { return stale_; }
+
+    [[nodiscard]] const std::vector<entry>& entries() const { return entries_; }
+    [[nodiscard]] stats get_stats() const { return { published_, skipped_ }; }
+
+private:
+    static uint64_t fnv1a(std::string_view data) {
+        uint64_t hash = 1469598103934665603ull;
+        for(unsigned char c : data) {
+            hash ^= c;
+            hash *= 1099511628211ull;
+        }
+        return hash;
+    }
+
+    nlohmann::json common(const std::string& key) const {
+        return {
+            { "name", device_ + " " + key },
+            { "unique_id", device_ + "_" + key },
+            { "device", { { "identifiers", { device_ } }, { "name", device_ }, { "manufacturer", "Friendly0Fire" },
+                          { "model", "mqttpresence" }, { "sw_version", "0.0.1" } } },
+        };
+    }
+
+    bool owned(std::string_view topic) const {
+        constexpr std::string_view suffix = "/config";
+        if(!topic.ends_with(suffix))
+            return false;
+        for(std::string_view component : { "homeassistant/binary_sensor/", "homeassistant/sensor/" }) {
+            if(topic.starts_with(component) && topic.substr(component.size()).starts_with(device_)
+               && topic.size() > component.size() + device_.size() + suffix.size() && topic[component.size() + device_.size()] == '/')
+                return true;
+        }
+        return false;
+    }
+
+    void add(std::string topic, const nlohmann::json& cfg) {
+        auto payload = cfg.dump();
+        uint64_t hash = fnv1a(payload);
+        index_[topic] = entries_.size();
+        entries_.push_back({ std::move(topic), std::move(payload), hash });
+    }
+
+    std::string device_;
+    std::vector<entry> entries_;
+    std::unordered_map<std::string, size_t> index_;
+    std::vector<std::string> stale_;
+    uint64_t published_ = 0, skipped_ = 0;
+};
@@ -0,0 +1,74 @@
+#pragma once
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include <cstdint>
+#include <unordered_map>
+
+#include "Reactor.h"
+
+// Waits on registered fds with epoll, with an eventfd for wakeups, for Linux builds of the presence core.
+class epoll_reactor : public reactor {
+public:
+    epoll_reactor() {
+        epoll_ = epoll_create1(EPOLL_CLOEXEC);
+        wake_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        epoll_event ev {};
+        ev.events = EPOLLIN;
+        ev.data.fd = wake_;
+        epoll_ctl(epoll_, EPOLL_CTL_ADD, wake_, &ev);
+    }
+
+    ~epoll_reactor() override {
+        close(wake_);
+        close(epoll_);
+    }
+
+    epoll_reactor(const epoll_reactor&) = delete;
+    epoll_reactor& operator=(const epoll_reactor&) = delete;
+
+    // Reactor thread only. fn runs whenever the fd is readable and has to drain it.
+    void add_fd(int fd, task fn) {
+        epoll_event ev {};
+        ev.events = EPOLLIN;
+        ev.data.fd = fd;
+        if(epoll_ctl(epoll_, EPOLL_CTL_ADD, fd, &ev) == 0)
+            handlers_[fd] = std::move(fn);
+    }
+
+    void remove_fd(int fd) {
+        epoll_ctl(epoll_, EPOLL_CTL_DEL, fd, nullptr);
+        handlers_.erase(fd);
+    }
+
+protected:
+    void wait(std::optional<clock::duration> timeout) override {
+        epoll_event events[16];
+        int n = epoll_wait(epoll_, events, 16, timeout ? static_cast<int>(timeout_ms(*timeout)) : -1);
+        for(int i = 0; i < n; i++) {
+            int fd = events[i].data.fd;
+            if(fd == wake_) {
+                uint64_t value;
+                [[maybe_unused]] auto r = read(wake_, &value, sizeof(value));
+                continue;
+            }
+
+            // The handler may unregister itself
+            auto it = handlers_.find(fd);
+            if(it != handlers_.end()) {
+                task fn = it->second;
+                fn();
+            }
+        }
+    }
+
+    void notify() override {
+        uint64_t one = 1;
+        [[maybe_unused]] auto r = write(wake_, &one, sizeof(one));
+    }
+
+private:
+    int epoll_ = -1;
+    int wake_ = -1;
+    std::unordered_map<int, task> handlers_;
+};
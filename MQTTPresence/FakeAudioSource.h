@@ -0,0 +1,65 @@
+#pragma once
+#include <algorithm>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "AudioSource.h"
+
+// Scriptable in-memory audio source, used to drive volume_check without any audio stack.
+class fake_audio_source : public audio_source {
+public:
+    void add_session(uint32_t pid, std::wstring path, float peak = 0.f, uint64_t start_time = 0) {
+        std::lock_guard lock(mutex_);
+        sessions_.push_back({ pid, start_time, std::move(path), peak });
+    }
+
+    void set_peak(uint32_t pid, float peak) {
+        std::lock_guard lock(mutex_);
+        for(auto& s : sessions_)
+            if(s.pid == pid)
+                s.peak = peak;
+    }
+
+    void remove_session(uint32_t pid) {
+        std::lock_guard lock(mutex_);
+        std::erase_if(sessions_, [pid](const session& s) { return s.pid == pid; });
+    }
+
+    [[nodiscard]] size_t sample_count() const {
+        std::lock_guard lock(mutex_);
+        return sample_count_;
+    }
+
+    void sample(std::vector<audio_session_sample>& out) override {
+        std::lock_guard lock(mutex_);
+        sample_count_++;
+        out.clear();
+        for(const auto& s : sessions_)
+            out.push_back({ s.pid, s.start_time, s.peak });
+    }
+
+    bool process_path(uint32_t pid, std::wstring& out) override {
+        std::lock_guard lock(mutex_);
+        for(const auto& s : sessions_) {
+            if(s.pid == pid) {
+                out = s.path;
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+private:
+    struct session {
+        uint32_t pid;
+        uint64_t start_time;
+        std::wstring path;
+        float peak;
+    };
+
+    mutable std::mutex mutex_;
+    std::vector<session> sessions_;
+    size_t sample_count_ = 0;
+};
@@ -0,0 +1,119 @@
+#pragma once
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <memory>
+
+#include "Reactor.h"
+
+// Platform source of change events for a single file. Backends watch the parent directory non-recursively,
+// so saves that replace the file are seen, but only report events naming the watched file.
+class file_watch_backend {
+public:
+    virtual ~file_watch_backend() = default;
+
+    // Registers with the backend's reactor; on_touched then runs on the reactor thread whenever the watched
+    // file is touched.
+    virtual void start(std::function<void()> on_touched) = 0;
+};
+
+// Turns raw file events into at most one report per actual content change: bursts of events (editors that
+// truncate, write and rename in several steps) are debounced, then the content hash is compared to the last one.
+class file_watch {
+public:
+    struct stats {
+        uint64_t events;
+        uint64_t reported;
+        uint64_t unchanged;
+    };
+
+    // on_change runs on the reactor thread once the file settled with different content. A file missing or
+    // unreadable at that point is not reported; whatever recreates it raises another event.
+    file_watch(reactor& reactor, std::unique_ptr<file_watch_backend> backend, std::filesystem::path path,
+               std::function<void()> on_change, std::chrono::milliseconds debounce = std::chrono::milliseconds(250))
+        : reactor_(reactor), backend_(std::move(backend)), path_(std::move(path)), on_change_(std::move(on_change)), debounce_(debounce) {
+        has_hash_ = hash_file(path_, hash_);
+        backend_->start([this]() { touched(); });
+    }
+
+    ~file_watch() {
+        if(timer_)
+            reactor_.cancel_timer(timer_);
+    }
+
+    file_watch(const file_watch&) = delete;
+    file_watch& operator=(const file_watch&) = delete;
+
+    [[nodiscard]] stats get_stats() const {
+        return { events_, reported_, unchanged_ };
+    }
+
+    // FNV-1a over the file contents
+    static bool hash_file(const std::filesystem::path& path, uint64_t& out) {
+        std::ifstream file(path, std::ios::binary);
+        if(!file)
+            return false;
+
+        uint64_t h = 14695981039346656037ull;
+        char buffer[4096];
+        while(file.read(buffer, sizeof(buffer)) || file.gcount() > 0) {
+            for(std::streamsize i = 0; i < file.gcount(); i++)
+                h = (h ^ static_cast<unsigned char>(buffer[i])) * 1099511628211ull;
+        }
+
+        out = h;
+        return true;
+    }
+
+private:
+    // Every event pushes the check back until the burst goes quiet, but never holds a constantly
+    // rewritten file back indefinitely
+    void touched() {
+        events_++;
+
+        auto now = reactor::clock::now();
+        if(!timer_)
+            burst_start_ = now;
+        else
+            reactor_.cancel_timer(timer_);
+
+        auto due = std::min(now + debounce_, burst_start_ + debounce_ * max_debounce_rounds_);
+        timer_ = reactor_.add_timer(due, [this]() { settled(); });
+    }
+
+    void settled() {
+        timer_ = 0;
+
+        uint64_t hash;
+        if(!hash_file(path_, hash))
+            return;
+
+        if(has_hash_ && hash == hash_) {
+            unchanged_++;
+            return;
+        }
+
+        hash_ = hash;
+        has_hash_ = true;
+        reported_++;
+        on_change_();
+    }
+
+    static constexpr int max_debounce_rounds_ = 8;
+
+    reactor& reactor_;
+    std::unique_ptr<file_watch_backend> backend_;
+    std::filesystem::path path_;
+    std::function<void()> on_change_;
+    std::chrono::milliseconds debounce_;
+
+    reactor::timer_id timer_ = 0;
+    reactor::clock::time_point burst_start_;
+
+    uint64_t hash_ = 0;
+    bool has_hash_ = false;
+
+    uint64_t events_ = 0, reported_ = 0, unchanged_ = 0;
+};
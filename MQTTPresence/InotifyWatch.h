@@ -0,0 +1,71 @@
+#pragma once
+#include <sys/inotify.h>
+#include <unistd.h>
+#include <filesystem>
+#include <functional>
+#include <string>
+
+#include "EpollReactor.h"
+#include "FileWatch.h"
+
+// File events from inotify on the file's parent directory, for Linux builds of the presence core.
+class inotify_watch : public file_watch_backend {
+public:
+    inotify_watch(epoll_reactor& reactor, const std::filesystem::path& path)
+        : reactor_(reactor), name_(path.filename().string()) {
+        fd_ = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if(fd_ >= 0)
+            inotify_add_watch(fd_, path.parent_path().c_str(),
+                              IN_CLOSE_WRITE | IN_MODIFY | IN_MOVED_TO | IN_CREATE | IN_DELETE | IN_MOVED_FROM);
+    }
+
+    ~inotify_watch() override {
+        if(fd_ >= 0) {
+            if(started_)
+                reactor_.remove_fd(fd_);
+            close(fd_);
+        }
+    }
+
+    inotify_watch(const inotify_watch&) = delete;
+    inotify_watch& operator=(const inotify_watch&) = delete;
+
+    void start(std::function<void()> on_touched) override {
+        if(fd_ < 0)
+            return;
+
+        on_touched_ = std::move(on_touched);
+        reactor_.add_fd(fd_, [this]() {
+            if(drain())
+                on_touched_();
+        });
+        started_ = true;
+    }
+
+private:
+    // Reads every queued event, returning whether any named the watched file or the queue overflowed.
+    bool drain() {
+        bool touched = false;
+        ssize_t len;
+        while((len = read(fd_, buffer_, sizeof(buffer_))) > 0) {
+            for(ssize_t offset = 0; offset < len;) {
+                const auto* ev = reinterpret_cast<const inotify_event*>(buffer_ + offset);
+                if(ev->mask & IN_Q_OVERFLOW)
+                    touched = true;
+                else if(ev->len > 0 && name_ == ev->name)
+                    touched = true;
+
+                offset += sizeof(inotify_event) + ev->len;
+            }
+        }
+
+        return touched;
+    }
+
+    epoll_reactor& reactor_;
+    std::string name_;
+    std::function<void()> on_touched_;
+    int fd_ = -1;
+    bool started_ = false;
+    alignas(inotify_event) char buffer_[4096];
+};
@@ -0,0 +1,102 @@
+#pragma once
+#include <windows.h>
+#include <algorithm>
+#include <chrono>
+#include <vector>
+
+// Closes a set of processes in parallel: every window is asked to close at once, all processes are waited on
+// against a single grace deadline, and whatever is still running afterwards is terminated. A wait covers at most
+// MAXIMUM_WAIT_OBJECTS handles, so larger sets are waited on one batch after another; everyone's windows were
+// asked to close up front, so a later batch still gets the whole grace period.
+class kill_engine {
+public:
+    struct target {
+        DWORD pid;
+        HANDLE process; // owned by the engine once passed to run()
+        std::vector<HWND> windows;
+    };
+
+    enum class result {
+        CLOSED,
+        TERMINATED,
+        FAILED
+    };
+
+    struct outcome {
+        DWORD pid;
+        result how;
+        std::chrono::milliseconds elapsed;
+    };
+
+    explicit kill_engine(std::chrono::milliseconds grace) : grace_(grace) {}
+
+    std::vector<outcome> run(std::vector<target> targets) const {
+        using clock = std::chrono::steady_clock;
+
+        std::vector<outcome> outcomes;
+        outcomes.reserve(targets.size());
+
+        const auto start = clock::now();
+        const auto deadline = start + grace_;
+        auto since_start = [&start]() {
+            return std::chrono::duration_cast<std::chrono::milliseconds>(clock::now() - start);
+        };
+
+        // Posting never blocks on a hung window, unlike a synchronous WM_CLOSE
+        std::vector<size_t> pending;
+        for(size_t i = 0; i < targets.size(); i++) {
+            if(targets[i].windows.empty())
+                continue;
+
+            for(auto hwnd : targets[i].windows)
+                PostMessage(hwnd, WM_CLOSE, 0, 0);
+            pending.push_back(i);
+        }
+
+        std::vector<bool> closed(targets.size());
+        std::vector<size_t> batch;
+        std::vector<HANDLE> handles;
+        for(size_t first = 0; first < pending.size(); first += MAXIMUM_WAIT_OBJECTS) {
+            batch.assign(pending.begin() + first, pending.begin() + std::min<size_t>(pending.size(), first + MAXIMUM_WAIT_OBJECTS));
+            while(!batch.empty()) {
+                auto now = clock::now();
+                if(now >= deadline)
+                    break;
+
+                handles.clear();
+                for(size_t i : batch)
+                    handles.push_back(targets[i].process);
+
+                auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - now).count();
+                DWORD rval = WaitForMultipleObjects(static_cast<DWORD>(handles.size()), handles.data(), false, static_cast<DWORD>(remaining));
+                if(rval >= WAIT_OBJECT_0 && rval < WAIT_OBJECT_0 + handles.size()) {
+                    size_t idx = rval - WAIT_OBJECT_0;
+                    closed[batch[idx]] = true;
+                    outcomes.push_back({ targets[batch[idx]].pid, result::CLOSED, since_start() });
+                    batch.erase(batch.begin() + idx);
+                } else
+                    break;
+            }
+        }
+
+        // Stragglers past the deadline; those in a batch not reached before it may still have exited meanwhile
+        for(size_t i = 0; i < targets.size(); i++) {
+            auto& t = targets[i];
+            if(!closed[i]) {
+                if(!t.windows.empty() && WaitForSingleObject(t.process, 0) == WAIT_OBJECT_0)
+                    outcomes.push_back({ t.pid, result::CLOSED, since_start() });
+                else if(TerminateProcess(t.process, 0))
+                    outcomes.push_back({ t.pid, result::TERMINATED, since_start() });
+                else
+                    outcomes.push_back({ t.pid, result::FAILED, since_start() });
+            }
+
+            CloseHandle(t.process);
+        }
+
+        return outcomes;
+    }
+
+private:
+    std::chrono::milliseconds grace_;
+};
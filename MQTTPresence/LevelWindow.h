@@ -0,0 +1,78 @@
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <vector>
+
+// Ring buffer of peak levels for a set of session columns. Each sampling tick is one contiguous row, so window
+// statistics are computed across all sessions at once with loops the compiler can vectorize.
+class level_window {
+public:
+    void reset(size_t columns, size_t depth) {
+        columns_ = columns;
+        depth_ = std::max<size_t>(depth, 1);
+        levels_.assign(columns_ * depth_, 0.f);
+        head_ = 0;
+        filled_ = 0;
+    }
+
+    [[nodiscard]] size_t columns() const { return columns_; }
+    [[nodiscard]] size_t depth() const { return depth_; }
+
+    // Widens every row, keeping the recorded history. New columns start out silent.
+    void grow(size_t columns) {
+        if(columns <= columns_)
+            return;
+
+        std::vector<float> wider(columns * depth_, 0.f);
+        for(size_t r = 0; r < depth_; r++)
+            std::copy_n(&levels_[r * columns_], columns_, &wider[r * columns]);
+        levels_.swap(wider);
+        columns_ = columns;
+    }
+
+    // Starts a new tick with every column at zero and returns it for writing.
+    float* next_row() {
+        head_ = (head_ + 1) % depth_;
+        filled_ = std::min(filled_ + 1, depth_);
+        float* row = &levels_[head_ * columns_];
+        std::fill_n(row, columns_, 0.f);
+        return row;
+    }
+
+    // Forgets a column's history, for when it is handed to a new session.
+    void clear_column(size_t column) {
+        for(size_t r = 0; r < depth_; r++)
+            levels_[r * columns_ + column] = 0.f;
+    }
+
+    // Max and RMS of each column over the most recent rows (at most the whole ring).
+    void compute(size_t rows, std::vector<float>& max, std::vector<float>& rms) const {
+        rows = std::min(rows, filled_);
+        max.assign(columns_, 0.f);
+        rms.assign(columns_, 0.f);
+        if(rows == 0)
+            return;
+
+        float* m = max.data();
+        float* sq = rms.data();
+        for(size_t i = 0; i < rows; i++) {
+            const float* row = &levels_[((head_ + depth_ - i) % depth_) * columns_];
+            for(size_t c = 0; c < columns_; c++) {
+                m[c] = row[c] > m[c] ? row[c] : m[c];
+                sq[c] += row[c] * row[c];
+            }
+        }
+
+        const float scale = 1.f / static_cast<float>(rows);
+        for(size_t c = 0; c < columns_; c++)
+            sq[c] = std::sqrt(sq[c] * scale);
+    }
+
+private:
+    std::vector<float> levels_;
+    size_t columns_ = 0;
+    size_t depth_ = 1;
+    size_t head_ = 0;
+    size_t filled_ = 0;
+};
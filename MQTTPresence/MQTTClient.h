@@ -1,16 +1,39 @@
 #pragma once
 
 #include <string>
+#ifdef _WIN32
 #include <debugapi.h>
+#endif
 
 #include <utility>
 #include <deque>
-
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <format>
+#include <functional>
+#include <iterator>
+#include <mutex>
+
+#include "Backoff.h"
+#include "Discovery.h"
 #include "MQTTPresence.h"
+#include "Metrics.h"
+#include "PresenceEngine.h"
+#include "PublishPolicy.h"
+#include "PublishQueue.h"
+#include "Reactor.h"
+#include "StatePublisher.h"
+#include "TransitionJournal.h"
 #include <mqtt/client.h>
 
-extern bool g_user_active;
-extern bool g_sound_active;
+// Where the client reports its own health; everything is optional
+struct mqtt_metrics {
+    const metrics_registry* registry = nullptr; // published as diagnostic sensors every interval seconds
+    int interval = 0;
+    metrics_registry::histogram* publish_latency = nullptr;
+    metrics_registry::counter* reconnects = nullptr;
+};
 
 enum class mqtt_status {
     DISCONNECTED = 0,
@@ -21,13 +44,9 @@ enum class mqtt_status {
 
 class mqtt_client {
 protected:
-    enum qos {
-        AT_MOST_ONCE = 0,
-        AT_LEAST_ONCE = 1,
-        EXACTLY_ONCE = 2
-    };
-
-    const qos default_qos_ = qos::EXACTLY_ONCE;
+    const publish_policy_table policies_;
+    const bool mqtt5_;
+    const bool consolidated_;
 
     class result_callback : public virtual mqtt::iaction_listener {
     protected:
@@ -48,36 +67,418 @@ protected:
             , success_(std::move(success)) { }
     };
 
-    const int periodic_interval_ = 10;
+    using clock = std::chrono::steady_clock;
+
+    const int keep_alive_interval_, refresh_interval_;
+    const size_t queue_capacity_ = 16;
+    // A publish taking longer counts as failed, so its topic is resent on the next change
+    const std::chrono::milliseconds send_timeout_ { 10000 };
 
     const std::string host_, port_, username_, password_, devicename_;
+    const std::string base_topic_;
     std::string will_content_;
-    std::thread periodic_;
+    reactor& reactor_;
+    // Read for the current states whenever they are resent, and for sensor names in the history
+    const presence_engine& presence_;
+    reactor::timer_id refresh_timer_ = 0;
     mqtt::async_client_ptr client_;
+    std::unique_ptr<publish_queue> queue_;
+    // Guards replacing queue_ against publishers, which do not hold connection_mutex_
+    mutable std::mutex queue_mutex_;
     std::atomic<mqtt_status> status_ = mqtt_status::DISCONNECTED;
+    // Set by disconnect(), so an in-flight publish gives up at its deadline
+    std::atomic<clock::rep> send_deadline_ = clock::time_point::max().time_since_epoch().count();
+
+    enum class state_topic {
+        USER = 0,
+        SOUND = 1,
+
+        COUNT
+    };
+
+    // Topics and payloads never change for the lifetime of the client, so they are built once
+    // and the hot path only ever copies shared pointers into the publish queue.
+    std::array<presence_engine::sensor_id, static_cast<size_t>(state_topic::COUNT)> sensors_;
+    std::unique_ptr<state_publisher> states_;
+    std::string disconnected_topic_;
+    mqtt::const_message_ptr connected_msg_, will_msg_;
+
+    void intern_messages() {
+        disconnected_topic_ = base_topic_ + "/disconnected/state";
+        history_topic_ = base_topic_ + "/history";
+        diagnostics_topic_ = base_topic_ + "/diagnostics";
+        discovery_sync_topic_ = base_topic_ + "/discovery_sync";
+        discovery_filters_ = { base_topic_ + "/+/config", "homeassistant/sensor/" + devicename_ + "/+/config", discovery_sync_topic_ };
+        connected_msg_ = make_message(disconnected_topic_, "OFF", message_class::AVAILABILITY);
+        will_msg_ = make_message(disconnected_topic_, "ON", message_class::AVAILABILITY);
+
+        states_ = std::make_unique<state_publisher>(base_topic_, std::vector<const char*> { "user", "sound" }, consolidated_,
+            [this](const std::string& topic, const std::string& payload, message_class cls) { return make_message(topic, payload, cls); });
+    }
+
+    // Every sensor the device exposes besides the diagnostics, which come from the metrics registry
+    struct binary_sensor_row {
+        const char* key;
+        const char* device_class;
+        bool state; // part of the state document in consolidated mode; the availability topic never is, as it is the will
+    };
+
+    static constexpr binary_sensor_row binary_sensors_[] = {
+        { "user", "presence", true },
+        { "sound", "sound", true },
+        { "disconnected", "problem", false },
+    };
+
+    void build_discovery() {
+        discovery_ = std::make_unique<discovery_set>(devicename_);
+        for(const auto& row : binary_sensors_) {
+            if(consolidated_ && row.state)
+                discovery_->add_binary_sensor(row.key, states_->document_topic(), row.device_class, true);
+            else
+                discovery_->add_binary_sensor(row.key, base_topic_ + "/" + row.key + "/state", row.device_class);
+        }
+        if(metrics_.registry && metrics_.interval > 0) {
+            for(const auto& field : metrics_.registry->describe())
+                discovery_->add_diagnostic(field.key, diagnostics_topic_, field.unit);
+        }
+    }
+
+    // Expects connection_mutex_ to be held. The broker sends retained messages right after accepting a
+    // subscription, ahead of anything published afterwards, so once our own marker comes back every retained
+    // config has been seen. Without retained discovery there is nothing to compare, so everything is published.
+    void sync_discovery() {
+        discovery_->reset();
+        if(!policy_for(policies_, message_class::DISCOVERY).retain) {
+            publish_discovery();
+            return;
+        }
+
+        try {
+            discovery_marker_ = std::to_string(++discovery_syncs_);
+            for(const auto& filter : discovery_filters_)
+                client_->subscribe(filter, 1);
+            client_->publish(mqtt::make_message(discovery_sync_topic_, discovery_marker_, 1, false));
+            discovery_syncing_ = true;
+            discovery_timer_ = reactor_.add_timer(discovery_sync_timeout_, [this]() {
+                std::lock_guard lock(connection_mutex_);
+                discovery_timer_ = 0;
+                if(discovery_syncing_)
+                    publish_discovery();
+            });
+        } catch(const mqtt::exception&) {
+            publish_discovery();
+        }
+    }
+
+    // Expects connection_mutex_ to be held
+    void discovery_received(const mqtt::const_message_ptr& msg) {
+        if(!discovery_syncing_)
+            return;
+
+        if(msg->get_topic() == discovery_sync_topic_) {
+            if(msg->to_string() == discovery_marker_)
+                publish_discovery();
+        } else if(msg->is_retained()) {
+            discovery_->seen(msg->get_topic(), msg->get_payload_str());
+        }
+    }
+
+    // Expects connection_mutex_ to be held
+    void publish_discovery() {
+        bool subscribed = std::exchange(discovery_syncing_, false);
+        if(discovery_timer_) {
+            reactor_.cancel_timer(discovery_timer_);
+            discovery_timer_ = 0;
+        }
+
+        try {
+            discovery_->for_each_changed([this](const discovery_set::entry& e) {
+                client_->publish(make_message(e.topic, e.payload, message_class::DISCOVERY));
+            });
+            // An empty retained payload removes the entity; stale configs are only known after a retained sync
+            for(const auto& topic : discovery_->stale())
+                client_->publish(make_message(topic, "", message_class::DISCOVERY));
+            if(subscribed) {
+                for(const auto& filter : discovery_filters_)
+                    client_->unsubscribe(filter);
+            }
+        } catch(const mqtt::exception& ex) {
+#ifdef _DEBUG
+            OutputDebugStringA((std::string("failed to publish discovery: ") + ex.what() + "\n").c_str());
+#endif
+        }
+    }
+
+    // Reactor thread only, as collecting reads components owned by it
+    void publish_diagnostics() {
+        std::string payload = "{";
+        for(const auto& f : metrics_.registry->snapshot()) {
+            if(payload.size() > 1)
+                payload += ',';
+            std::format_to(std::back_inserter(payload), R"("{}":{})", f.key, f.value);
+        }
+        payload += '}';
+
+        std::lock_guard lock(connection_mutex_);
+        if(status_ != mqtt_status::CONNECTED)
+            return;
+
+        try {
+            client_->publish(make_message(diagnostics_topic_, payload, message_class::DIAGNOSTICS));
+        } catch(const mqtt::exception&) {
+            // Dropped; the next interval sends fresh values anyway
+        }
+    }
+
+    mqtt::message_ptr make_message(const std::string& topic, const std::string& payload, message_class cls) const {
+        const auto& policy = policy_for(policies_, cls);
+        auto msg = mqtt::make_message(topic, payload, policy.qos, policy.retain);
+        if(policy.expiry > 0 && mqtt5_) {
+            mqtt::properties props;
+            props.add(mqtt::property(mqtt::property::MESSAGE_EXPIRY_INTERVAL, static_cast<int>(policy.expiry)));
+            msg->set_properties(props);
+        }
+        return msg;
+    }
+
+    bool send(const mqtt::const_message_ptr& msg) {
+        try {
+            auto start = clock::now();
+            auto deadline = std::min(start + send_timeout_, clock::time_point(clock::duration(send_deadline_.load())));
+            if(!client_->publish(msg)->wait_for(std::max(deadline - clock::now(), clock::duration::zero())))
+                return false;
+
+            if(metrics_.publish_latency)
+                metrics_.publish_latency->record_since(start);
+            return true;
+        } catch(const mqtt::exception& ex) {
+#ifdef _DEBUG
+            OutputDebugStringA((std::string("failed: ") + ex.what() + "\n").c_str());
+#endif
+            return false;
+        }
+    }
+
+    // Resends every state as the presence engine currently has it
+    void publish_current(bool force) const {
+        for(size_t i = 0; i < sensors_.size(); i++)
+            publish_state(static_cast<state_topic>(i), presence_.sensor(sensors_[i]), force);
+    }
+
+    void publish_state(state_topic topic, bool state, bool force = false) const {
+        std::lock_guard lock(queue_mutex_);
+        if(status_ == mqtt_status::DISCONNECTED || !queue_)
+            return;
+
+#ifdef _DEBUG
+        OutputDebugStringA(states_->name(static_cast<size_t>(topic)));
+        OutputDebugStringA(state ? "_active = true\n" : "_active = false\n");
+#endif
 
-    std::string base_topic() const { return "homeassistant/binary_sensor/" + devicename_; }
+        states_->publish(*queue_, static_cast<size_t>(topic), state, force);
+    }
+
+    // Connection state changes come from paho's threads, the reactor and the caller, so they are serialized here
+    std::mutex connection_mutex_;
+    mqtt::connect_options connopts_;
+    jittered_backoff backoff_ { std::chrono::milliseconds(1000), std::chrono::milliseconds(60000) };
+    reactor::timer_id retry_timer_ = 0, republish_timer_ = 0;
+    std::function<void(mqtt_status)> status_handler_;
+    bool connected_before_ = false;
+
+    mqtt_metrics metrics_;
+    std::string diagnostics_topic_;
+    reactor::timer_id diagnostics_timer_ = 0;
+
+    result_callback connect_listener_ {
+        [this](const mqtt::token&) { connected(); },
+        [this](const mqtt::token&) { connection_failed(); }
+    };
 
-    void broadcast_home_assistant_config(const std::string& name, const char* device_class) {
-	    
-        auto ha_cfg = base_topic() + "/" + name + "/config";
-        auto ha_cfg_contents = std::format(R"MARK(
-{{
-	"name": "{1} {0}",
-	"dev_cla": "{3}",
-	"stat_t": "{2}/{0}/state",
-	"device": {{ "identifiers": ["{1}"], "name": "{1}", "manufacturer": "Friendly0Fire", "model": "mqttpresence", "sw_version": "0.0.1" }},
-	"unique_id": "{1}_{0}"
-}}
-    )MARK", name, devicename_, base_topic(), device_class);
-        client_->publish(ha_cfg.c_str(), ha_cfg_contents.c_str(), ha_cfg_contents.size(), default_qos_, true);
+    // Transitions are replayed one batch at a time, each acknowledged in the journal once the broker has it.
+    // Besides on every connection, whatever accumulated is flushed every history interval, away from the
+    // transitions themselves so they stay cheap.
+    transition_journal* journal_ = nullptr;
+    std::string history_topic_;
+    const size_t history_batch_ = 64;
+    const std::chrono::seconds history_interval_ { 60 };
+    reactor::timer_id history_timer_ = 0;
+    bool replaying_ = false;
+    uint64_t replay_next_ = 0;
+
+    result_callback history_listener_ {
+        [this](const mqtt::token&) { history_delivered(); },
+        [this](const mqtt::token&) { history_failed(); }
+    };
+
+    // Discovery is only republished where the broker's retained copy differs, see sync_discovery()
+    std::unique_ptr<discovery_set> discovery_;
+    std::string discovery_sync_topic_, discovery_marker_;
+    std::array<std::string, 3> discovery_filters_;
+    const std::chrono::milliseconds discovery_sync_timeout_ { 5000 };
+    reactor::timer_id discovery_timer_ = 0;
+    bool discovery_syncing_ = false;
+    uint64_t discovery_syncs_ = 0;
+
+    void notify_status(mqtt_status status) {
+        std::function<void(mqtt_status)> handler;
+        {
+            std::lock_guard lock(connection_mutex_);
+            handler = status_handler_;
+        }
+        if(handler)
+            handler(status);
+    }
+
+    // Both expect connection_mutex_ to be held
+    void attempt() {
+        retry_timer_ = 0;
+        try {
+            client_->connect(connopts_, nullptr, connect_listener_);
+        } catch(const mqtt::exception& ex) {
+#ifdef _DEBUG
+            OutputDebugStringA((std::string("failed to connect: ") + ex.what() + "\n").c_str());
+#endif
+            schedule_retry();
+        }
+    }
+
+    void schedule_retry() {
+        auto delay = backoff_.next();
+#ifdef _DEBUG
+        OutputDebugStringA(std::format("Reconnecting in {} ms\n", delay.count()).c_str());
+#endif
+        retry_timer_ = reactor_.add_timer(delay, [this]() {
+            std::lock_guard lock(connection_mutex_);
+            if(status_ == mqtt_status::CONNECTING)
+                attempt();
+        });
+    }
+
+    void connected() {
+        {
+            std::lock_guard lock(connection_mutex_);
+            if(status_ != mqtt_status::CONNECTING)
+                return;
+
+            status_ = mqtt_status::CONNECTED;
+            backoff_.reset();
+            if(std::exchange(connected_before_, true) && metrics_.reconnects)
+                metrics_.reconnects->add();
+
+            // Whatever the broker had from us may be gone, and our will may have fired while we were away
+            sync_discovery();
+            try {
+                client_->publish(connected_msg_);
+            } catch(const mqtt::exception& ex) {
+#ifdef _DEBUG
+                OutputDebugStringA((std::string("failed to publish availability: ") + ex.what() + "\n").c_str());
+#endif
+            }
+
+            // Resent from the reactor, where sensor changes are published too. Read here, on paho's thread, a state
+            // could be overtaken by a change published in the meantime and then overwrite it in the queue.
+            queue_->invalidate();
+            queue_->resume();
+            republish_timer_ = reactor_.add_timer(clock::duration::zero(), [this]() {
+                {
+                    std::lock_guard lock(connection_mutex_);
+                    republish_timer_ = 0;
+                    if(status_ != mqtt_status::CONNECTED)
+                        return;
+                }
+                publish_current(true);
+            });
+
+            replaying_ = false;
+            replay();
+        }
+        notify_status(mqtt_status::CONNECTED);
+    }
+
+    // Expects connection_mutex_ to be held
+    void replay() {
+        if(status_ != mqtt_status::CONNECTED || !journal_ || replaying_)
+            return;
+
+        auto batch = journal_->read(history_batch_);
+        if(batch.records.empty())
+            return;
+
+        std::string payload = "[";
+        for(const auto& r : batch.records) {
+            if(r.sensor >= presence_.sensor_count())
+                continue;
+            if(payload.size() > 1)
+                payload += ',';
+            std::format_to(std::back_inserter(payload), R"({{"time":{},"sensor":"{}","state":"{}","present":"{}"}})",
+                           r.time, presence_.name(r.sensor), r.value ? "ON" : "OFF", r.present ? "ON" : "OFF");
+        }
+        payload += ']';
+
+        try {
+            client_->publish(make_message(history_topic_, payload, message_class::HISTORY), nullptr, history_listener_);
+            replaying_ = true;
+            replay_next_ = batch.next;
+        } catch(const mqtt::exception& ex) {
+#ifdef _DEBUG
+            OutputDebugStringA((std::string("failed to replay history: ") + ex.what() + "\n").c_str());
+#endif
+        }
+    }
+
+    void history_delivered() {
+        std::lock_guard lock(connection_mutex_);
+        replaying_ = false;
+        journal_->acknowledge(replay_next_);
+        replay();
+    }
+
+    // Left unacknowledged, so it is replayed again on the next connection or flush
+    void history_failed() {
+        std::lock_guard lock(connection_mutex_);
+        replaying_ = false;
+    }
+
+    void connection_failed() {
+        std::lock_guard lock(connection_mutex_);
+        if(status_ == mqtt_status::CONNECTING)
+            schedule_retry();
+    }
+
+    // Sending stops until the next connection, with states buffered in the meantime
+    void connection_lost() {
+        {
+            std::lock_guard lock(connection_mutex_);
+            if(status_ != mqtt_status::CONNECTED)
+                return;
+
+            status_ = mqtt_status::CONNECTING;
+            queue_->pause();
+            discovery_syncing_ = false;
+            if(discovery_timer_) {
+                reactor_.cancel_timer(discovery_timer_);
+                discovery_timer_ = 0;
+            }
+            schedule_retry();
+        }
+        notify_status(mqtt_status::CONNECTING);
     }
 
 public:
 
     mqtt_client(std::string host, std::string port, std::string username,
-                std::string password, std::string devicename)
-        : host_(std::move(host)), port_(std::move(port)), username_(std::move(username)), password_(std::move(password)), devicename_(std::move(devicename)) {}
+                std::string password, std::string devicename, int keep_alive_interval, int refresh_interval,
+                const publish_policy_table& policies, reactor& reactor, const presence_engine& presence,
+                presence_engine::sensor_id user_sensor, presence_engine::sensor_id sound_sensor, bool consolidated_state = false)
+        : policies_(policies), mqtt5_(needs_mqtt5(policies)), consolidated_(consolidated_state)
+        , keep_alive_interval_(keep_alive_interval), refresh_interval_(refresh_interval)
+        , host_(std::move(host)), port_(std::move(port)), username_(std::move(username)), password_(std::move(password)), devicename_(std::move(devicename))
+        , base_topic_("homeassistant/binary_sensor/" + devicename_), reactor_(reactor), presence_(presence) {
+        sensors_[static_cast<size_t>(state_topic::USER)] = user_sensor;
+        sensors_[static_cast<size_t>(state_topic::SOUND)] = sound_sensor;
+        intern_messages();
+    }
 
     ~mqtt_client() {
         if(!client_)
@@ -88,34 +489,90 @@ public:
 
     mqtt_status status() const { return status_; }
 
+    [[nodiscard]] publish_queue::stats queue_stats() const {
+        std::lock_guard lock(queue_mutex_);
+        return queue_ ? queue_->get_stats() : publish_queue::stats{};
+    }
+
+    [[nodiscard]] discovery_set::stats discovery_stats() {
+        std::lock_guard lock(connection_mutex_);
+        return discovery_ ? discovery_->get_stats() : discovery_set::stats{};
+    }
+
     void disconnect() {
-        if(status_ != mqtt_status::CONNECTED)
-            return;
+        using namespace std::chrono_literals;
+        disconnect(clock::now() + 3s);
+    }
 
-        status_ = mqtt_status::DISCONNECTING;
+    // Publishes the final OFF states if connected, then disconnects, abandoning whatever is left at the deadline.
+    // Returns whether the final states were all handed to the broker in time.
+    bool disconnect(clock::time_point deadline) {
+        mqtt_status was;
+        {
+            std::lock_guard lock(connection_mutex_);
+            was = status_;
+            if(was == mqtt_status::DISCONNECTED || was == mqtt_status::DISCONNECTING)
+                return false;
+
+            status_ = mqtt_status::DISCONNECTING;
+            if(retry_timer_) {
+                reactor_.cancel_timer(retry_timer_);
+                retry_timer_ = 0;
+            }
+            if(republish_timer_) {
+                reactor_.cancel_timer(republish_timer_);
+                republish_timer_ = 0;
+            }
+            discovery_syncing_ = false;
+            if(discovery_timer_) {
+                reactor_.cancel_timer(discovery_timer_);
+                discovery_timer_ = 0;
+            }
+        }
 
 #ifdef _DEBUG
         OutputDebugStringA("Disconnecting...\n");
 #endif
 
-        if(periodic_.joinable())
-            periodic_.join();
-
-#ifdef _DEBUG
-        OutputDebugStringA("Periodic thread joined...\n");
-#endif
+        if(refresh_timer_) {
+            reactor_.cancel_timer(refresh_timer_);
+            refresh_timer_ = 0;
+        }
+        if(diagnostics_timer_) {
+            reactor_.cancel_timer(diagnostics_timer_);
+            diagnostics_timer_ = 0;
+        }
+        if(history_timer_) {
+            reactor_.cancel_timer(history_timer_);
+            history_timer_ = 0;
+        }
         
-        user_active(false);
-        sound_active(false);
+        auto remaining = [deadline]() {
+            return std::chrono::ceil<std::chrono::milliseconds>(std::max(deadline - clock::now(), clock::duration::zero()));
+        };
+        send_deadline_ = deadline.time_since_epoch().count();
+
+        // States buffered while offline are dropped; the will already reports us as gone
+        bool delivered = false;
+        if(was == mqtt_status::CONNECTED) {
+            const auto failed = queue_->get_stats().failed;
+            user_active(false);
+            sound_active(false);
+            delivered = queue_->flush(remaining()) && queue_->get_stats().failed == failed;
+        }
+        queue_->stop();
 
 #ifdef _DEBUG
         OutputDebugStringA("Activity messages sent...\n");
 #endif
         try
         {
-            client_->disconnect(1000)->wait();
+            if(was == mqtt_status::CONNECTED) {
+                auto timeout = remaining();
+                client_->disconnect(static_cast<int>(timeout.count()))->wait_for(timeout);
+            }
         }
-        catch (mqtt::exception ex)
+        catch (const mqtt::exception& ex)
         {
 #ifdef _DEBUG
             OutputDebugStringA(std::format("Disconnect exception: {}", ex.to_string().c_str()).c_str());
@@ -126,113 +583,113 @@ public:
         OutputDebugStringA("Disconnection processed...\n");
 #endif
 
+        {
+            std::lock_guard lock(queue_mutex_);
+            queue_.reset();
+        }
         client_.reset();
 
         status_ = mqtt_status::DISCONNECTED;
+        send_deadline_ = clock::time_point::max().time_since_epoch().count();
+        notify_status(mqtt_status::DISCONNECTED);
 
 #ifdef _DEBUG
         OutputDebugStringA("Client destroyed.\n");
 #endif
+        return delivered;
     }
 
+    // Returns immediately. The connection is made and kept up in the background, retrying with jittered backoff;
+    // until it is up, states are buffered latest-value-per-topic and sent once it is.
     void connect() {
+        std::lock_guard lock(connection_mutex_);
         if(status_ != mqtt_status::DISCONNECTED)
             return;
 
         status_ = mqtt_status::CONNECTING;
 
-        client_ = std::make_unique<mqtt::async_client>(host_ + ":" + port_, g_unique_identifier);
+        client_ = std::make_unique<mqtt::async_client>(host_ + ":" + port_, g_unique_identifier,
+                                                       mqtt::create_options(mqtt5_ ? MQTTVERSION_5 : MQTTVERSION_DEFAULT));
 
-        mqtt::connect_options connopts;
+        connopts_ = mqtt::connect_options();
+        if(mqtt5_) {
+            connopts_.set_mqtt_version(MQTTVERSION_5);
+            connopts_.set_clean_session(false);
+            connopts_.set_clean_start(true);
+        }
 
         if (!username_.empty())
-            connopts.set_user_name(username_);
+            connopts_.set_user_name(username_);
         if (!password_.empty())
-            connopts.set_password(password_);
+            connopts_.set_password(password_);
 
-        connopts.set_automatic_reconnect(1000, 30000);
+        connopts_.set_keep_alive_interval(keep_alive_interval_);
+        connopts_.set_will_message(will_msg_);
 
-        {
-            mqtt::will_options willopts;
-            willopts.set_topic(base_topic() + "/disconnected/state");
-            willopts.set_payload(mqtt::string("ON"));
-            willopts.set_retained(false);
-            willopts.set_qos(default_qos_);
+        client_->set_connection_lost_handler([this](const std::string&) { connection_lost(); });
+        client_->set_message_callback([this](mqtt::const_message_ptr msg) {
+            std::lock_guard lock(connection_mutex_);
+            discovery_received(msg);
+        });
+        build_discovery();
 
-            connopts.set_will(std::move(willopts));
+        auto queue = std::make_unique<publish_queue>(queue_capacity_, [this](const mqtt::const_message_ptr& msg) { return send(msg); });
+        states_->register_topics(*queue);
+        queue->pause();
+        {
+            std::lock_guard queue_lock(queue_mutex_);
+            queue_ = std::move(queue);
         }
 
-        try {
-            client_->connect(connopts)->wait();
-            status_ = mqtt_status::CONNECTED;
-            
-            broadcast_home_assistant_config("user", "presence");
-            broadcast_home_assistant_config("sound", "sound");
-            broadcast_home_assistant_config("disconnected", "problem");
-            client_->publish(base_topic() + "/disconnected/state", mqtt::string("OFF"), qos::EXACTLY_ONCE, true);
-
-            user_active(true);
-            sound_active(false);
-
-            periodic_ = std::thread([&]() {
-                using namespace std::chrono_literals;
-
-                int i = 0;
-                while(status_ == mqtt_status::CONNECTED) {
-                    if(i >= periodic_interval_) {
-                        i = 0;
-
-                        user_active();
-                        sound_active();
-                    }
+        // States are retained and the will covers liveness, so this only refreshes them
+        // in case the broker dropped its retained store. Unchanged states are otherwise never resent.
+        if(refresh_interval_ > 0) {
+            const auto period = std::chrono::seconds(refresh_interval_);
+            refresh_timer_ = reactor_.add_timer(period, [this]() {
+                publish_current(true);
+            }, period);
+        }
 
-                    i++;
-                    std::this_thread::sleep_for(1s);
-                }
-            });
-        } catch(const mqtt::exception& ex) {
-#ifdef _DEBUG
-            OutputDebugStringA((std::string("failed to connect: ") + ex.what() + "\n").c_str());
-#endif
-            if(periodic_.joinable())
-                periodic_.join();
+        // The first snapshot goes out soon after starting, so dashboards do not wait a whole interval
+        if(metrics_.registry && metrics_.interval > 0) {
+            const auto period = std::chrono::seconds(metrics_.interval);
+            diagnostics_timer_ = reactor_.add_timer(std::min<clock::duration>(period, std::chrono::seconds(10)),
+                                                    [this]() { publish_diagnostics(); }, period);
+        }
 
-            client_.reset();
-            status_ = mqtt_status::DISCONNECTED;
+        if(journal_) {
+            history_timer_ = reactor_.add_timer(history_interval_, [this]() {
+                std::lock_guard lock(connection_mutex_);
+                replay();
+            }, history_interval_);
         }
-    }
 
-    void user_active(bool state = g_user_active) const {
-        if(status_ == mqtt_status::DISCONNECTED)
-            return;
+        backoff_.reset();
+        attempt();
+    }
 
-#ifdef _DEBUG
-        OutputDebugStringA((std::string("user_active = ") + (state ? "true" : "false") + "\n").c_str());
-#endif
+    // Set before connect()
+    void set_metrics(const mqtt_metrics& metrics) {
+        metrics_ = metrics;
+    }
 
-        try {
-            client_->publish(base_topic() + "/user/state", state ? "ON" : "OFF", default_qos_, false)->wait();
-        } catch(const mqtt::exception& ex) {
-#ifdef _DEBUG
-            OutputDebugStringA((std::string("failed: ") + ex.what() + "\n").c_str());
-#endif
-        }
+    // Set before connect(); the journal has to outlive the client
+    void set_journal(transition_journal* journal) {
+        std::lock_guard lock(connection_mutex_);
+        journal_ = journal;
     }
 
-    void sound_active(bool state = g_sound_active) const {
-        if (status_ == mqtt_status::DISCONNECTED)
-            return;
+    // Called on the thread that changed the status; DISCONNECTED is only reported after disconnect()
+    void set_status_handler(std::function<void(mqtt_status)> handler) {
+        std::lock_guard lock(connection_mutex_);
+        status_handler_ = std::move(handler);
+    }
 
-#ifdef _DEBUG
-        OutputDebugStringA((std::string("sound_active = ") + (state ? "true" : "false") + "\n").c_str());
-#endif
+    void user_active(bool state) const {
+        publish_state(state_topic::USER, state);
+    }
 
-        try {
-            client_->publish(base_topic() + "/sound/state", state ? "ON" : "OFF", default_qos_, false)->wait();
-        } catch(const mqtt::exception& ex) {
-#ifdef _DEBUG
-            OutputDebugStringA((std::string("failed: ") + ex.what() + "\n").c_str());
-#endif
-        }
+    void sound_active(bool state) const {
+        publish_state(state_topic::SOUND, state);
     }
 };
\ No newline at end of file
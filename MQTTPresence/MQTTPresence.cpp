@@ -5,20 +5,39 @@
 #include <strsafe.h>
 #include <Shlobj.h>
 #include <Shlwapi.h>
-#include <Psapi.h>
 
 #include "MQTTPresence.h"
 #include "MQTTClient.h"
 
+#include <thread>
 #include <fstream>
+#include <mutex>
+#include <utility>
 #include <vector>
 #include <filesystem>
 
 #include <nlohmann/json.hpp>
 #include <cxxopts.hpp>
 
+#include "ActionEngine.h"
+#include "Benchmark.h"
+#include "Config.h"
+#include "FileWatch.h"
 #include "Registry.h"
-#include "VolumeCheck.h"
+#include "SoundSampler.h"
+#include "MappedFile.h"
+#include "Metrics.h"
+#include "PresenceEngine.h"
+#include "ProcessMatcher.h"
+#include "ReadDirectoryChangesWatch.h"
+#include "Reactor.h"
+#include "Teardown.h"
+#include "ToolhelpProcessInventory.h"
+#include "TransitionJournal.h"
+#include "VolumeWorker.h"
+#include "WasapiAudioSource.h"
+#include "Win32ActionBackend.h"
+#include "Win32Reactor.h"
 
 
 #pragma comment(linker,"/manifestdependency:\"type='win32' name='Microsoft.Windows.Common-Controls' version='6.0.0.0' processorArchitecture='*' publicKeyToken='6595b64144ccf1df' language='*'\"")
@@ -26,6 +45,10 @@
 // Constants //
 TCHAR g_startup_reg_key[] = TEXT("SOFTWARE\\Microsoft\\Windows\\CurrentVersion\\Run");
 UINT const WMAPP_NOTIFYCALLBACK = WM_APP + 1;
+// Windows may end the process a few seconds into WM_ENDSESSION, so teardown has to be done well before that
+std::chrono::milliseconds const g_teardown_budget(3000);
+// Transitions kept for replay to the history topic, 16 bytes each
+uint32_t const g_journal_capacity = 4096;
 
 // Load Once //
 TCHAR g_program_path[MAX_PATH];
@@ -33,21 +56,54 @@ bool g_startup = false, g_elevated = false;
 HINSTANCE g_hinst = nullptr;
 
 // Main Loop //
-std::atomic<bool> g_running = true;
-std::atomic<bool> g_restart = true;
-
-mqtt_client* g_mqtt = nullptr;
+std::atomic<std::shared_ptr<mqtt_client>> g_mqtt;
+// Disconnects a client replaced by a reload, so its final flush never holds up the reactor
+std::thread g_retired_mqtt;
 TCHAR g_config_dir[MAX_PATH];
 TCHAR g_config_path[MAX_PATH];
-HANDLE g_config_watch;
-std::string g_mqtt_host, g_mqtt_port, g_mqtt_topic, g_mqtt_username, g_mqtt_password;
-std::vector<std::string> g_volume_processes;
-std::vector<std::pair<std::string, std::string>> g_start_processes;
-std::vector<std::string> g_kill_processes;
-bool g_enable_volume = true, g_enable_activity = true;
-bool g_volume_check_all_devices = false;
-
-bool g_user_active = false, g_sound_active = false;
+std::atomic<std::shared_ptr<const config>> g_config;
+process_selector g_process_selector(std::make_unique<toolhelp_process_inventory>());
+action_engine g_actions(g_process_selector, std::make_unique<win32_action_backend>(g_process_selector));
+
+std::chrono::microseconds g_last_reload_latency {};
+std::chrono::microseconds g_last_teardown {};
+
+// Published as diagnostic sensors. Everything is registered here, before anything can update it.
+metrics_registry g_metrics;
+metrics_registry::histogram& g_publish_latency = g_metrics.add_histogram("publish_latency");
+metrics_registry::counter& g_reconnects = g_metrics.add_counter("reconnects");
+metrics_registry::histogram& g_volume_poll_time = g_metrics.add_histogram("volume_poll");
+metrics_registry::counter& g_sessions_scanned = g_metrics.add_counter("sessions_scanned");
+metrics_registry::histogram& g_kill_time = g_metrics.add_histogram("kill_action");
+metrics_registry::histogram& g_start_time = g_metrics.add_histogram("start_action");
+metrics_registry::histogram& g_reload_time = g_metrics.add_histogram("config_reload");
+metrics_registry::gauge& g_teardown_time = g_metrics.add_gauge("last_teardown", "ms");
+metrics_registry::gauge& g_reactor_wakeups = g_metrics.add_gauge("reactor_wakeups");
+metrics_registry::gauge& g_sound_polls_per_hour = g_metrics.add_gauge("sound_polls_per_hour");
+metrics_registry::gauge& g_queue_depth = g_metrics.add_gauge("publish_queue_depth");
+metrics_registry::gauge& g_queue_dropped = g_metrics.add_gauge("publish_queue_dropped");
+metrics_registry::gauge& g_discovery_published = g_metrics.add_gauge("discovery_published");
+metrics_registry::gauge& g_discovery_skipped = g_metrics.add_gauge("discovery_skipped");
+metrics_registry::gauge& g_journal_pending = g_metrics.add_gauge("journal_pending");
+metrics_registry::gauge& g_journal_lost = g_metrics.add_gauge("journal_lost");
+
+// Everything after startup runs on this thread: window messages, timers, the config watch, volume polling
+// and reconnecting to the broker.
+win32_reactor g_reactor;
+std::unique_ptr<file_watch> g_config_watch;
+
+// Appended to on the reactor thread only
+std::unique_ptr<mapped_file> g_journal_file;
+std::unique_ptr<transition_journal> g_journal;
+
+// Set while main_loop runs
+HWND g_hwnd = nullptr;
+HPOWERNOTIFY g_power_notify = nullptr;
+volume_worker* g_volume = nullptr;
+
+presence_engine g_presence;
+presence_engine::sensor_id g_user_sensor = g_presence.add_sensor("user");
+presence_engine::sensor_id g_sound_sensor = g_presence.add_sensor("sound");
 
 template <typename... Args>
 void fatal_message_box(Args&&... args) {
@@ -55,11 +111,6 @@ void fatal_message_box(Args&&... args) {
     exit(1);
 }
 
-enum class activity_change_t {
-    USER_ACTIVE,
-    SOUND_ACTIVE
-};
-
 enum class elevated_commands_t {
     SET_STARTUP_ON = 1,
     SET_STARTUP_OFF = 2,
@@ -118,131 +169,38 @@ void launch_elevated(elevated_commands_t cmds) {
         throw errcode_exception(exit_code);
 }
 
-enum class activity_change_result_t
-{
-    INACTIVE = -1,
-    NO_CHANGE = 0,
-    ACTIVE = 1
-};
+void SetNotificationIconTooltip(HWND hwnd, const TCHAR* msg);
+void end_session();
 
-void on_activity_change(activity_change_t changed, bool value)
+// Publishes each sensor on its own topic
+void on_sensor_change(presence_engine::sensor_id sensor, bool value)
 {
-    // If the "change" didn't change the values, exit immediately
-    if (changed == activity_change_t::SOUND_ACTIVE && value == g_sound_active
-     || changed == activity_change_t::USER_ACTIVE  && value == g_user_active)
-        return;
-
-    activity_change_result_t change = activity_change_result_t::NO_CHANGE;
-    if (changed == activity_change_t::SOUND_ACTIVE)
-    {
-        g_sound_active = value;
-
-        // If sound is now active and user is not, we just activated
-        if (g_sound_active && !g_user_active)
-            change = activity_change_result_t::ACTIVE;
-        // If sound is now inactive and user already was not, we just deactivated
-        else if (!g_sound_active && !g_user_active)
-            change = activity_change_result_t::INACTIVE;
+    if (g_hwnd) {
+        bool user_active = g_presence.sensor(g_user_sensor), sound_active = g_presence.sensor(g_sound_sensor);
+        auto notification = std::format(L"User active: {}\nSound active: {}", user_active, sound_active);
+        SetNotificationIconTooltip(g_hwnd, notification.c_str());
+    }
 
-        g_mqtt->sound_active();
+    if (g_journal) {
+        auto now = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch());
+        g_journal->append(now.count(), static_cast<uint8_t>(sensor), value, g_presence.present());
     }
-    else if (changed == activity_change_t::USER_ACTIVE)
-    {
-        g_user_active = value;
 
-        // If user is now active and sound is not, we just activated
-        if (g_user_active && !g_sound_active)
-            change = activity_change_result_t::ACTIVE;
-        // If user is now inactive and sound already was not, we just deactivated
-        else if (!g_user_active && !g_sound_active)
-            change = activity_change_result_t::INACTIVE;
+    auto mqtt = g_mqtt.load();
+    if (!mqtt)
+        return;
 
-        g_mqtt->user_active();
-    }
+    if (sensor == g_user_sensor)
+        mqtt->user_active(value);
+    else if (sensor == g_sound_sensor)
+        mqtt->sound_active(value);
+}
 
-    if (!g_start_processes.empty() && change == activity_change_result_t::ACTIVE)
-    {
-        STARTUPINFOA startupinfo;
-        ZeroMemory(&startupinfo, sizeof(STARTUPINFOA));
-        startupinfo.cb = sizeof(STARTUPINFOA);
-        startupinfo.dwFlags = STARTF_USESHOWWINDOW;
-        startupinfo.wShowWindow = SW_HIDE;
-        PROCESS_INFORMATION pinfo;
-
-        for (const auto& p : g_start_processes) {
-            std::string cmdline = std::format("\"{}\" {}", p.first, p.second);
-            CreateProcessA(
-                nullptr,
-                cmdline.data(),
-                nullptr,
-                nullptr,
-                false,
-                0,
-                nullptr,
-                std::filesystem::path(p.first).parent_path().string().c_str(),
-                &startupinfo,
-                &pinfo
-            );
-        }
-    }
-    else if(!g_kill_processes.empty() && change == activity_change_result_t::INACTIVE)
-    {
-        std::map<DWORD, std::list<HWND>> proc_window_map;
-        auto cb = [](HWND hwnd, LPARAM map_) -> BOOL {
-            auto& map = *reinterpret_cast<decltype(proc_window_map)*>(map_);
-
-            DWORD pid;
-            GetWindowThreadProcessId(hwnd, &pid);
-            map[pid].push_back(hwnd);
-
-            return true;
-        };
-        EnumWindows(cb, reinterpret_cast<LPARAM>(&proc_window_map));
-
-        const size_t max_proc_ids = 1024;
-        DWORD proc_list[max_proc_ids];
-        DWORD proc_size;
-        if (EnumProcesses(proc_list, sizeof(proc_list), &proc_size))
-        {
-            size_t proc_count = proc_size / sizeof(DWORD);
-            for (size_t i = 0; i < proc_count; i++)
-            {
-                HANDLE proc = OpenProcess(PROCESS_ALL_ACCESS, false, proc_list[i]);
-                if (!proc)
-                    continue;
-
-                char proc_path[MAX_PATH];
-                DWORD proc_path_size = MAX_PATH;
-                if (!QueryFullProcessImageNameA(proc, 0, proc_path, &proc_path_size))
-                {
-                    CloseHandle(proc);
-                    continue;
-                }
-
-                auto proc_fname = to_lower(std::filesystem::path(proc_path).filename().string());
-
-                if (std::find(g_kill_processes.begin(), g_kill_processes.end(), proc_fname) == g_kill_processes.end())
-                    continue;
-
-                if (proc_window_map.count(proc_list[i]) > 0)
-                {
-                    const auto& windows = proc_window_map[proc_list[i]];
-
-                    for (auto& hwnd : windows)
-                        SendMessageTimeout(hwnd, WM_CLOSE, 0, 0, SMTO_ABORTIFHUNG, 1000, nullptr);
-
-                    DWORD rval = WaitForSingleObject(proc, 1000);
-                    if (rval == WAIT_OBJECT_0) {
-                        CloseHandle(proc);
-                        continue;
-                    }
-                }
-
-                TerminateProcess(proc, 0);
-                CloseHandle(proc);
-            }
-        }
-    }
+// Runs the configured actions when the presence rule's result flips
+void on_presence_change(bool present)
+{
+    if (auto cfg = g_config.load())
+        g_actions.on_presence_change(*cfg, present);
 }
 
 bool get_startup() {
@@ -274,6 +232,19 @@ inline void toggle_startup() {
     set_startup(!get_startup());
 }
 
+// Returns nullptr if the file cannot be parsed, e.g. when caught halfway through being saved.
+std::shared_ptr<const config> read_config() {
+    try {
+        // The generated default file is commented, so comments are accepted
+        std::ifstream cfg_file(g_config_path);
+        return parse_config(nlohmann::json::parse(cfg_file, nullptr, true, true));
+    } catch (const nlohmann::json::exception&) {
+        return nullptr;
+    }
+}
+
+void reload_config();
+
 void load_config() {
     if (FAILED(SHGetFolderPath(nullptr, CSIDL_APPDATA, nullptr, 0, g_config_dir)))
         fatal_message_box(nullptr, TEXT("Could not locate AppData folder."), TEXT("Fatal Error"), MB_OK | MB_ICONERROR);
@@ -287,68 +258,7 @@ void load_config() {
     _tcscpy_s(g_config_path, g_config_dir);
     PathAppend(g_config_path, TEXT("config.json"));
 
-    if (PathFileExists(g_config_path)) {
-
-        std::ifstream cfg_file(g_config_path);
-        nlohmann::json cfg;
-        cfg_file >> cfg;
-
-        g_mqtt_host = cfg.value("mqttHost", "localhost");
-        g_mqtt_port = std::to_string(cfg.value("mqttPort", 1883));
-        g_mqtt_topic = cfg.value("mqttTopic", "winmqttpresence");
-        g_mqtt_username = cfg.value("mqttUsername", "");
-        g_mqtt_password = cfg.value("mqttPassword", "");
-
-        if (cfg.contains("volumeProcesses")) {
-            const auto& processes = cfg["volumeProcesses"];
-            if (processes.is_array()) {
-                for (const auto& proc : processes) {
-                    if (proc.is_string())
-                        g_volume_processes.push_back(proc);
-                }
-            }
-        }
-
-        if (cfg.contains("killProcesses")) {
-            const auto& processes = cfg["killProcesses"];
-            if (processes.is_array()) {
-                for (const auto& proc : processes) {
-                    if (proc.is_string())
-                        g_kill_processes.push_back(to_lower(proc));
-                }
-            }
-        }
-
-        if (cfg.contains("startProcesses")) {
-            const auto& processes = cfg["startProcesses"];
-            if (processes.is_array()) {
-                for (const auto& proc : processes) {
-                    if (proc.is_string())
-                        g_start_processes.push_back(std::make_pair(to_lower(proc), std::string()));
-                    else if (proc.is_array())
-                    {
-                        std::string app;
-                        std::string args;
-                        for (const auto& element : proc) {
-                            if (app.empty())
-                                app = element;
-                            else if (args.empty())
-                                args = element;
-                            else
-                                args += " " + element.get<std::string>();
-                        }
-
-                        g_start_processes.push_back(std::make_pair(to_lower(app), args));
-                    }
-                }
-            }
-        }
-        
-        g_enable_volume = cfg.value("enableVolumeCheck", true);
-        g_enable_activity = cfg.value("enableActivityCheck", true);
-        g_volume_check_all_devices = cfg.value("enableVolumeCheckAllDevices", false);
-    }
-    else {
+    if (!PathFileExists(g_config_path)) {
         std::ofstream out(g_config_path);
         out <<
             R"MARK(
@@ -358,11 +268,24 @@ void load_config() {
     "mqttUsername": "", // remove or leave blank if unneeded
     "mqttPassword": "", // remove or leave blank if unneeded
     "mqttTopic": "winmqttpresence", // defaults to 'winmqttpresence'
+    "mqttKeepAlive": 60, // defaults to 60; seconds between MQTT keepalive pings, which also bounds how quickly the broker notices we are gone
+    "stateRefreshInterval": 0, // defaults to 0; if non-zero, unchanged states are republished every this many seconds, otherwise they are only sent when they change
+    "diagnosticsInterval": 60, // defaults to 60; seconds between publishing the agent's own metrics as diagnostic sensors, 0 to disable
+    "consolidatedState": false, // defaults to false; if true, every check is published together as one JSON document on <mqttTopic>/state, rather than one topic per check
+    "publishPolicy": {}, // optional per message class overrides of {"qos": 0-2, "retain": true/false, "expiry": seconds (MQTT 5 only, 0 = never)}; classes are discovery, state, heartbeat, availability, diagnostics and history
     "enableVolumeCheck": true, // defaults to true
-    "volumeProcesses": [], // if empty, all processes are checked; otherwise, only check a list of executables (with extensions)
+    "volumeProcesses": [], // if empty, all processes are checked; otherwise, only check a list of executables (with extensions, case-insensitive, '*' and '?' wildcards allowed, full paths if a pattern contains a path separator)
     "enableActivityCheck": true, // defaults to true
+    "presenceRule": "", // defaults to present while any check is; otherwise an expression over the "user" and "sound" checks using |, &, ! and parentheses, e.g. "user & sound"
     "enableVolumeCheckAllDevices": false, // defaults to false; if true, all audio output devices are checked for sound output, otherwise only the default one is
-    "killProcesses": [], // if all presence checks indicate away, kill these executables (with extensions)
+    "soundOnDelay": 0, // defaults to 0; milliseconds sound has to persist before it is reported
+    "soundOffDelay": 50000, // defaults to 50000; milliseconds of silence before sound is reported as stopped
+    "soundPollFast": 1000, // defaults to 1000; milliseconds between volume polls right after a change
+    "soundPollSlow": 5000, // defaults to 5000; milliseconds between volume polls once the state has been stable for a while
+    "soundSampleInterval": 100, // defaults to 100; milliseconds between audio meter readings, which polls look at as a whole; 0 only reads the meters when polling
+    "killProcesses": [], // if all presence checks indicate away, kill these executables (same patterns as volumeProcesses)
+    "killProcessTree": false, // defaults to false; if true, child processes of killed executables are closed along with them
+    "killGracePeriod": 1000, // defaults to 1000; milliseconds all killed processes get, together, to close their windows before being terminated
     "startProcesses": [] // if any presence check indicates present, start these processes (provide full paths as strings, or optionally arrays with the path as the first element and any arguments to pass as further elements)
 }
 )MARK";
@@ -372,7 +295,23 @@ void load_config() {
             open_file(g_config_path);
     }
 
-    g_config_watch = FindFirstChangeNotification(g_config_dir, true, FILE_NOTIFY_CHANGE_FILE_NAME | FILE_NOTIFY_CHANGE_LAST_WRITE | FILE_NOTIFY_CHANGE_SIZE);
+    auto cfg = read_config();
+    if (!cfg)
+        fatal_message_box(nullptr, TEXT("Could not parse config file."), TEXT("Fatal Error"), MB_OK | MB_ICONERROR);
+
+    g_config = cfg;
+    g_actions.set_start_entries(cfg->start_processes);
+    if (!g_presence.set_rule(cfg->presence_rule))
+        fatal_message_box(nullptr, TEXT("Invalid presenceRule in config file."), TEXT("Fatal Error"), MB_OK | MB_ICONERROR);
+
+    // Without a journal transitions are still published, just not kept for the history topic
+    g_journal_file = std::make_unique<mapped_file>(std::filesystem::path(g_config_dir) / "journal.bin",
+                                                   transition_journal::bytes_for(g_journal_capacity));
+    if (*g_journal_file)
+        g_journal = std::make_unique<transition_journal>(g_journal_file->data(), g_journal_capacity);
+
+    std::filesystem::path path(g_config_path);
+    g_config_watch = std::make_unique<file_watch>(g_reactor, std::make_unique<read_directory_changes_watch>(g_reactor, path), path, reload_config);
 }
 
 void parse_options(int argc, LPWSTR* wargv) {
@@ -388,7 +327,8 @@ void parse_options(int argc, LPWSTR* wargv) {
     options.add_options()
         ("s,startup", "Launch on startup")
         ("n,no-startup", "Do not launch on startup")
-        ("c,cmd", "Command line action only, will not install to tray");
+        ("c,cmd", "Command line action only, will not install to tray")
+        ("b,benchmark", "Run the benchmark suite and write its JSON results to this file (with --cmd)", cxxopts::value<std::string>());
 
     auto result = options.parse(argc, raw_argv);
     
@@ -396,6 +336,13 @@ void parse_options(int argc, LPWSTR* wargv) {
         if (result["s"].as<bool>() || result["n"].as<bool>())
             set_startup(result["s"].as<bool>());
 
+        if (result.count("b")) {
+            auto results = benchmark_suite().run();
+            std::ofstream out(result["b"].as<std::string>());
+            out << results.dump(2) << '\n';
+            exit(out && results["over_budget"].empty() ? 0 : 1);
+        }
+
         exit(0);
     }
 }
@@ -528,16 +475,15 @@ LRESULT CALLBACK WndProc(HWND hwnd, UINT message, WPARAM wParam, LPARAM lParam)
         if (!wParam)
             break;
 
-        g_running = false;
-        g_restart = false;
-        g_mqtt->disconnect();
-        g_mqtt = nullptr;
+        // The process may be ended as soon as this returns
+        end_session();
+        g_reactor.stop();
         break;
     case WM_POWERBROADCAST: {
         if(wParam == PBT_POWERSETTINGCHANGE) {
             auto data = reinterpret_cast<POWERBROADCAST_SETTING*>(lParam);
             bool new_active = *reinterpret_cast<DWORD*>(&data->Data) != PowerUserInactive;
-            on_activity_change(activity_change_t::USER_ACTIVE, new_active);
+            g_presence.set(g_user_sensor, new_active);
         }
     } break;
     default:
@@ -546,124 +492,227 @@ LRESULT CALLBACK WndProc(HWND hwnd, UINT message, WPARAM wParam, LPARAM lParam)
     return 0;
 }
 
+// Presence keeps being tracked while the broker is unreachable, so losing it is only worth a notification
+void on_mqtt_status(mqtt_status status) {
+    g_reactor.post([status]() {
+        static bool lost = false;
+        if (!g_hwnd)
+            return;
+
+        if (status == mqtt_status::CONNECTING) {
+            lost = true;
+            SetNotificationIconMessage(g_hwnd, TEXT("Connection lost, reconnecting..."));
+        }
+        else if (status == mqtt_status::CONNECTED && lost) {
+            lost = false;
+            SetNotificationIconMessage(g_hwnd, TEXT("Reconnected."));
+        }
+    });
+}
+
+// Copies the stats components keep themselves into the registry; runs on the reactor thread before each snapshot
+void collect_metrics() {
+    g_teardown_time.set(g_last_teardown.count() / 1000.0);
+    g_reactor_wakeups.set(static_cast<double>(g_reactor.get_stats().wakeups));
+    if (g_volume)
+        g_sound_polls_per_hour.set(g_volume->sampler_stats().polls_per_hour);
+    if (auto mqtt = g_mqtt.load()) {
+        auto queue = mqtt->queue_stats();
+        g_queue_depth.set(static_cast<double>(queue.depth));
+        g_queue_dropped.set(static_cast<double>(queue.dropped));
+        auto discovery = mqtt->discovery_stats();
+        g_discovery_published.set(static_cast<double>(discovery.published));
+        g_discovery_skipped.set(static_cast<double>(discovery.skipped));
+    }
+    if (g_journal) {
+        auto journal = g_journal->get_stats();
+        g_journal_pending.set(static_cast<double>(journal.pending));
+        g_journal_lost.set(static_cast<double>(journal.lost));
+    }
+}
+
+std::shared_ptr<mqtt_client> make_mqtt_client(const config& cfg) {
+    auto mqtt = std::make_shared<mqtt_client>(cfg.mqtt_host, cfg.mqtt_port, cfg.mqtt_username, cfg.mqtt_password, cfg.mqtt_topic,
+                                              cfg.mqtt_keep_alive, cfg.state_refresh_interval, cfg.publish_policies, g_reactor,
+                                              g_presence, g_user_sensor, g_sound_sensor, cfg.consolidated_state);
+    mqtt->set_status_handler(on_mqtt_status);
+    mqtt->set_journal(g_journal.get());
+    mqtt->set_metrics({ &g_metrics, cfg.diagnostics_interval, &g_publish_latency, &g_reconnects });
+    return mqtt;
+}
+
+std::unique_ptr<audio_source> make_audio_source(const config& cfg) {
+    return std::make_unique<wasapi_audio_source>(cfg.volume_check_all_devices);
+}
+
+HPOWERNOTIFY register_activity(HWND hwnd) {
+    return RegisterPowerSettingNotification(hwnd, &GUID_SESSION_USER_PRESENCE, DEVICE_NOTIFY_WINDOW_HANDLE);
+}
+
+// Disconnects a replaced client on its own thread within g_teardown_budget. A previous one still flushing is
+// waited for first, so at most one is in flight.
+void retire_mqtt(std::shared_ptr<mqtt_client> mqtt) {
+    if (g_retired_mqtt.joinable())
+        g_retired_mqtt.join();
+    g_retired_mqtt = std::thread([mqtt = std::move(mqtt)]() {
+        teardown_timer timer(g_teardown_budget);
+        mqtt->disconnect(timer.deadline());
+    });
+}
+
+// Applies a reloaded configuration section by section; sections that did not change are left running.
+// Returns false if a section was rejected and kept its previous settings.
+bool apply_config(HWND hwnd, const std::shared_ptr<const config>& next, volume_worker& volume, HPOWERNOTIFY& power_notify) {
+    auto prev = g_config.exchange(next);
+    unsigned changed = diff_config(*prev, *next);
+
+    // Kill settings are read from the snapshot on every use, so swapping it was enough
+    if (changed & CONFIG_START)
+        g_actions.set_start_entries(next->start_processes);
+
+    bool ok = true;
+    if (changed & CONFIG_PRESENCE)
+        ok = g_presence.set_rule(next->presence_rule);
+
+    if (changed & CONFIG_VOLUME) {
+        // A fresh worker starts out silent and only reports flips, so the sensor has to start out silent too
+        volume.stop();
+        g_presence.set(g_sound_sensor, false);
+        if (next->enable_volume)
+            volume.start(*next);
+    }
+    else {
+        if (changed & CONFIG_VOLUME_PROCESSES)
+            volume.set_process_matcher(next->volume_matcher);
+        if (changed & CONFIG_SOUND_SAMPLING)
+            volume.set_sampler_settings(next->sound_sampling);
+    }
+
+    if (changed & CONFIG_ACTIVITY) {
+        if (power_notify) {
+            UnregisterPowerSettingNotification(power_notify);
+            power_notify = nullptr;
+        }
+        if (next->enable_activity)
+            power_notify = register_activity(hwnd);
+        g_presence.set(g_user_sensor, next->enable_activity);
+    }
+
+    if (changed & CONFIG_MQTT) {
+        if (auto old = g_mqtt.exchange(nullptr))
+            retire_mqtt(std::move(old));
+
+        auto mqtt = make_mqtt_client(*next);
+        g_mqtt = mqtt;
+        mqtt->connect();
+    }
+
+#ifdef _DEBUG
+    OutputDebugStringA(std::format("Configuration reloaded, changed sections: {:#x}\n", changed).c_str());
+#endif
+
+    return ok;
+}
+
+// Runs on the reactor thread once the config file settled with new content
+void reload_config() {
+    auto since = std::chrono::steady_clock::now();
+    auto next = read_config();
+    if (!next || !g_hwnd)
+        return;
+
+    bool ok = apply_config(g_hwnd, next, *g_volume, g_power_notify);
+    g_last_reload_latency = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - since);
+    g_reload_time.record(g_last_reload_latency);
+
+    if (ok) {
+        auto notification = std::format(L"Configuration reloaded in {} ms", g_last_reload_latency.count() / 1000);
+        SetNotificationIconMessage(g_hwnd, notification.c_str());
+    }
+    else
+        SetNotificationIconMessage(g_hwnd, TEXT("Configuration reloaded, but presenceRule is invalid and was not changed."));
+}
+
+// Stops everything main_loop started within g_teardown_budget. The final OFF states are flushed to the broker
+// on their own thread while the rest is stopped, so neither waits on the other.
+void end_session() {
+    HWND hwnd = std::exchange(g_hwnd, nullptr);
+    if (!hwnd)
+        return;
+
+    teardown_timer timer(g_teardown_budget);
+
+    std::chrono::microseconds flush_elapsed {};
+    bool delivered = false;
+    std::thread flush([&timer, &flush_elapsed, &delivered, mqtt = g_mqtt.exchange(nullptr)]() {
+        auto start = teardown_timer::clock::now();
+        if (mqtt)
+            delivered = mqtt->disconnect(timer.deadline());
+        flush_elapsed = std::chrono::duration_cast<std::chrono::microseconds>(teardown_timer::clock::now() - start);
+    });
+
+    if (g_volume)
+        g_volume->stop();
+    g_volume = nullptr;
+    timer.mark("volume");
+
+    if (g_power_notify) {
+        UnregisterPowerSettingNotification(g_power_notify);
+        g_power_notify = nullptr;
+    }
+    timer.mark("activity");
+
+    g_actions.begin_teardown(timer.deadline());
+    g_presence.set(g_sound_sensor, false);
+    g_presence.set(g_user_sensor, false);
+    timer.mark("presence");
+
+    flush.join();
+    if (g_retired_mqtt.joinable())
+        g_retired_mqtt.join();
+    timer.record("mqtt", flush_elapsed);
+
+    g_last_teardown = timer.total();
+#ifdef _DEBUG
+    for (const auto& p : timer.phases())
+        OutputDebugStringA(std::format("Teardown {}: {} us\n", p.name, p.elapsed.count()).c_str());
+    OutputDebugStringA(std::format("Teardown took {} us{}{}\n", g_last_teardown.count(),
+                                   delivered ? "" : ", final states not confirmed", timer.overran() ? ", over budget" : "").c_str());
+#endif
+}
+
 void main_loop(HINSTANCE hInstance) {
-    load_config();
+    auto cfg = g_config.load();
 
     WCHAR window_title[100];
     LoadString(hInstance, IDS_APP_TITLE, window_title, ARRAYSIZE(window_title));
     HWND hwnd = CreateWindow(CHOOSE_TSTR(g_unique_identifier), window_title, WS_OVERLAPPEDWINDOW,
                              CW_USEDEFAULT, 0, 250, 200, NULL, NULL, g_hinst, nullptr);
     if (hwnd) {
-        auto* powerNotify = g_enable_activity ? RegisterPowerSettingNotification(hwnd, &GUID_SESSION_USER_PRESENCE, DEVICE_NOTIFY_WINDOW_HANDLE) : nullptr;
+        g_power_notify = cfg->enable_activity ? register_activity(hwnd) : nullptr;
 
         ShowWindow(hwnd, SW_HIDE);
 
-        mqtt_client mqtt(g_mqtt_host, g_mqtt_port, g_mqtt_username, g_mqtt_password, g_mqtt_topic);
-        g_mqtt = &mqtt;
-
-        // ReSharper disable once CppJoinDeclarationAndAssignment
-        volume_check volume;
-        std::atomic<bool> volume_thread_signal = true;
-        std::thread volume_thread;
-        if(g_enable_volume) {
-            // ReSharper disable once CppJoinDeclarationAndAssignment
-            volume = volume_check(g_volume_check_all_devices);
-            for(const auto& proc : g_volume_processes)
-                volume.add_process_name(s2ws(proc));
-
-            volume_thread = std::thread([&volume, &volume_thread_signal]() {
-                using namespace std::chrono_literals;
-                std::this_thread::sleep_for(5s);
-
-                int no_sound_ticks = 0;
-
-                while(volume_thread_signal) {
-                    bool new_active = volume.poll();
-                    if (!new_active)
-                        no_sound_ticks++;
-                    else
-                        no_sound_ticks = 0;
-
-                    if(new_active || no_sound_ticks > 10)
-                        on_activity_change(activity_change_t::SOUND_ACTIVE, new_active);
-                    std::this_thread::sleep_for(5s);
-                }
-            });
-        }
-        
-        std::atomic<bool> config_thread_signal = true;
-        std::thread config_thread = std::thread([&config_thread_signal, hwnd]() {
-            while(config_thread_signal) {
-                DWORD wait_status = WaitForSingleObject(g_config_watch, 1000);
-                if(wait_status == WAIT_OBJECT_0) {
-                    SetNotificationIconMessage(hwnd, TEXT("Configuration reloading..."));
-                    g_running = false;
-                    g_restart = true;
-
-                    FindNextChangeNotification(g_config_watch);
-                    break;
-                }
-            }
-        });
-
-        mqtt.connect();
-
-        if (g_enable_activity)
-            on_activity_change(activity_change_t::USER_ACTIVE, true);
-        if(g_enable_volume)
-            on_activity_change(activity_change_t::SOUND_ACTIVE, false);
-
-        bool last_sound_active = false;
-        bool last_user_active = false;
-        MSG msg;
-        while (g_running) {
-            if(mqtt.status() == mqtt_status::DISCONNECTED) {
-                g_running = false;
-                g_restart = true;
-                SetNotificationIconMessage(hwnd, TEXT("Connection lost, reconnecting..."));
-                break;
-            }
-
-            if (MsgWaitForMultipleObjects(0, nullptr, false, 1000, QS_ALLINPUT) == WAIT_OBJECT_0) {
-                while(PeekMessage(&msg, nullptr, 0, 0, PM_REMOVE)) {
-                    TranslateMessage(&msg);
-                    DispatchMessage(&msg);
-                    if(msg.message == WM_QUIT) {
-                        g_running = false;
-                        break;
-                    }
-                }
-            }
+        g_mqtt = make_mqtt_client(*cfg);
 
-            if (last_sound_active != g_sound_active || last_user_active != g_user_active) {
-                last_sound_active = g_sound_active;
-                last_user_active = g_user_active;
+        volume_worker volume(g_reactor, make_audio_source, [](bool active) { g_presence.set(g_sound_sensor, active); });
+        volume.set_metrics(&g_volume_poll_time, &g_sessions_scanned);
+        if(cfg->enable_volume)
+            volume.start(*cfg);
 
-                auto notification = std::format(L"User active: {}\nSound active: {}", g_user_active, g_sound_active);
-
-                SetNotificationIconTooltip(hwnd, notification.c_str());
-            }
-        }
+        g_hwnd = hwnd;
+        g_volume = &volume;
 
-        volume_thread_signal = false;
-        if(volume_thread.joinable())
-            volume_thread.join();
+        g_mqtt.load()->connect();
 
-        config_thread_signal = false;
-        config_thread.join();
+        if (cfg->enable_activity)
+            g_presence.set(g_user_sensor, true);
+        if(cfg->enable_volume)
+            g_presence.set(g_sound_sensor, false);
 
-        FindCloseChangeNotification(g_config_watch);
+        g_reactor.run();
 
-        if(g_enable_activity)
-            UnregisterPowerSettingNotification(powerNotify);
-
-        if (g_mqtt) {
-            g_mqtt->sound_active(false);
-            g_mqtt->user_active(false);
-        }
-
-        on_activity_change(activity_change_t::SOUND_ACTIVE, false);
-        on_activity_change(activity_change_t::USER_ACTIVE, false);
+        end_session();
 
         DestroyWindow(hwnd);
     }
@@ -689,12 +738,15 @@ int APIENTRY wWinMain(HINSTANCE hInstance, HINSTANCE, PWSTR lpCmdLine, int /*nCm
     }
     
     RegisterWindowClass(g_unique_identifierW, MAKEINTRESOURCE(IDC_MQTTPRESENCE), WndProc);
+    g_presence.on_sensor_change(on_sensor_change);
+    g_presence.on_presence_change(on_presence_change);
+    g_actions.set_metrics(&g_start_time, &g_kill_time);
+    g_metrics.on_collect(collect_metrics);
+    load_config();
 
-    while(g_restart) {
-        g_running = true;
-        g_restart = false;
-        main_loop(hInstance);
-    }
+    main_loop(hInstance);
+
+    g_config_watch.reset();
 
     CoUninitialize();
 
@@ -5,6 +5,7 @@
 #include "Resource.h"
 #include <string>
 #include <codecvt>
+#include <locale>
 #include <algorithm>
 
 #define DEF_TSTR(name, val) \
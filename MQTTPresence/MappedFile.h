@@ -0,0 +1,50 @@
+#pragma once
+#include <windows.h>
+#include <cstddef>
+#include <filesystem>
+
+// Read-write view of the start of a file, which is created or grown to the requested size. Writes reach the
+// file through the system cache, so they survive the process ending without any explicit flush.
+class mapped_file {
+public:
+    mapped_file(const std::filesystem::path& path, size_t size) {
+        file_ = CreateFileW(path.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, nullptr, OPEN_ALWAYS,
+                            FILE_ATTRIBUTE_NORMAL, nullptr);
+        if(file_ == INVALID_HANDLE_VALUE)
+            return;
+
+        ULARGE_INTEGER length;
+        length.QuadPart = size;
+        mapping_ = CreateFileMappingW(file_, nullptr, PAGE_READWRITE, length.HighPart, length.LowPart, nullptr);
+        if(!mapping_)
+            return;
+
+        data_ = MapViewOfFile(mapping_, FILE_MAP_ALL_ACCESS, 0, 0, size);
+        if(data_)
+            size_ = size;
+    }
+
+    ~mapped_file() {
+        if(data_) {
+            FlushViewOfFile(data_, 0);
+            UnmapViewOfFile(data_);
+        }
+        if(mapping_)
+            CloseHandle(mapping_);
+        if(file_ != INVALID_HANDLE_VALUE)
+            CloseHandle(file_);
+    }
+
+    mapped_file(const mapped_file&) = delete;
+    mapped_file& operator=(const mapped_file&) = delete;
+
+    [[nodiscard]] void* data() const { return data_; }
+    [[nodiscard]] size_t size() const { return size_; }
+    explicit operator bool() const { return data_ != nullptr; }
+
+private:
+    HANDLE file_ = INVALID_HANDLE_VALUE;
+    HANDLE mapping_ = nullptr;
+    void* data_ = nullptr;
+    size_t size_ = 0;
+};
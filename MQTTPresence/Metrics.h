@@ -0,0 +1,170 @@
+#pragma once
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <string>
+#include <vector>
+
+// Counters, gauges and latency histograms that are registered once at startup and then updated lock-free from
+// any thread. A snapshot flattens them into named fields, which is what gets published.
+class metrics_registry {
+public:
+    class counter {
+    public:
+        void add(uint64_t n = 1) { value_.fetch_add(n, std::memory_order_relaxed); }
+        [[nodiscard]] uint64_t value() const { return value_.load(std::memory_order_relaxed); }
+
+    private:
+        std::atomic<uint64_t> value_ = 0;
+    };
+
+    class gauge {
+    public:
+        void set(double v) { value_.store(v, std::memory_order_relaxed); }
+        [[nodiscard]] double value() const { return value_.load(std::memory_order_relaxed); }
+
+    private:
+        std::atomic<double> value_ = 0;
+    };
+
+    // Fixed buckets growing by 4x from 100 us; the last one holds everything above ~6.5 s
+    class histogram {
+    public:
+        static constexpr size_t bucket_count = 10;
+        static constexpr uint64_t first_bound_us = 100;
+
+        void record(std::chrono::microseconds elapsed) {
+            uint64_t us = static_cast<uint64_t>(std::max<int64_t>(elapsed.count(), 0));
+            size_t b = 0;
+            for(uint64_t bound = first_bound_us; b < bucket_count - 1 && us > bound; bound *= 4)
+                b++;
+
+            buckets_[b].fetch_add(1, std::memory_order_relaxed);
+            count_.fetch_add(1, std::memory_order_relaxed);
+            sum_us_.fetch_add(us, std::memory_order_relaxed);
+
+            uint64_t max = max_us_.load(std::memory_order_relaxed);
+            while(us > max && !max_us_.compare_exchange_weak(max, us, std::memory_order_relaxed))
+                ;
+        }
+
+        void record_since(std::chrono::steady_clock::time_point start) {
+            record(std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start));
+        }
+
+        [[nodiscard]] uint64_t count() const { return count_.load(std::memory_order_relaxed); }
+        [[nodiscard]] uint64_t max_us() const { return max_us_.load(std::memory_order_relaxed); }
+
+        [[nodiscard]] double mean_us() const {
+            uint64_t n = count();
+            return n ? static_cast<double>(sum_us_.load(std::memory_order_relaxed)) / n : 0;
+        }
+
+        // Upper bound of the bucket the quantile falls in, capped by the largest value seen
+        [[nodiscard]] uint64_t quantile_us(double q) const {
+            uint64_t n = count();
+            if(n == 0)
+                return 0;
+
+            uint64_t target = static_cast<uint64_t>(q * n), seen = 0, bound = first_bound_us;
+            for(size_t b = 0; b < bucket_count - 1; b++, bound *= 4) {
+                seen += buckets_[b].load(std::memory_order_relaxed);
+                if(seen > target)
+                    return std::min(bound, max_us());
+            }
+            return max_us();
+        }
+
+    private:
+        std::array<std::atomic<uint64_t>, bucket_count> buckets_ {};
+        std::atomic<uint64_t> count_ = 0, sum_us_ = 0, max_us_ = 0;
+    };
+
+    struct field {
+        std::string key;
+        const char* unit;
+        double value;
+    };
+
+    // Registration is not thread-safe; everything is registered before the first update or snapshot
+    counter& add_counter(std::string name, const char* unit = "") {
+        entries_.push_back({ std::move(name), unit, kind::COUNTER, counters_.size() });
+        return counters_.emplace_back();
+    }
+
+    gauge& add_gauge(std::string name, const char* unit = "") {
+        entries_.push_back({ std::move(name), unit, kind::GAUGE, gauges_.size() });
+        return gauges_.emplace_back();
+    }
+
+    // Published as count, mean, p95 and max, in milliseconds
+    histogram& add_histogram(std::string name) {
+        entries_.push_back({ std::move(name), "ms", kind::HISTOGRAM, histograms_.size() });
+        return histograms_.emplace_back();
+    }
+
+    // Runs before every snapshot, e.g. to copy a component's own stats into gauges
+    void on_collect(std::function<void()> fn) {
+        collectors_.push_back(std::move(fn));
+    }
+
+    // Keys and units of every field a snapshot has, without collecting values
+    [[nodiscard]] std::vector<field> describe() const {
+        std::vector<field> out;
+        for(const auto& e : entries_)
+            expand(e, out, false);
+        return out;
+    }
+
+    [[nodiscard]] std::vector<field> snapshot() const {
+        for(const auto& fn : collectors_)
+            fn();
+
+        std::vector<field> out;
+        for(const auto& e : entries_)
+            expand(e, out, true);
+        return out;
+    }
+
+private:
+    enum class kind {
+        COUNTER,
+        GAUGE,
+        HISTOGRAM
+    };
+
+    struct entry {
+        std::string name;
+        const char* unit;
+        kind type;
+        size_t index;
+    };
+
+    void expand(const entry& e, std::vector<field>& out, bool values) const {
+        switch(e.type) {
+        case kind::COUNTER:
+            out.push_back({ e.name, e.unit, values ? static_cast<double>(counters_[e.index].value()) : 0 });
+            break;
+        case kind::GAUGE:
+            out.push_back({ e.name, e.unit, values ? gauges_[e.index].value() : 0 });
+            break;
+        case kind::HISTOGRAM: {
+            const auto& h = histograms_[e.index];
+            out.push_back({ e.name + "_count", "", values ? static_cast<double>(h.count()) : 0 });
+            out.push_back({ e.name + "_mean", e.unit, values ? h.mean_us() / 1000 : 0 });
+            out.push_back({ e.name + "_p95", e.unit, values ? h.quantile_us(0.95) / 1000.0 : 0 });
+            out.push_back({ e.name + "_max", e.unit, values ? h.max_us() / 1000.0 : 0 });
+        } break;
+        }
+    }
+
+    std::vector<entry> entries_;
+    std::deque<counter> counters_; // deques keep handed out references valid
+    std::deque<gauge> gauges_;
+    std::deque<histogram> histograms_;
+    std::vector<std::function<void()>> collectors_;
+};
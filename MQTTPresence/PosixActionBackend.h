@@ -0,0 +1,217 @@
+#pragma once
+#include <signal.h>
+#include <spawn.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <filesystem>
+#include <functional>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "ActionEngine.h"
+#include "MQTTPresence.h"
+
+extern char** environ;
+
+// Launches with posix_spawn and closes processes with SIGTERM, then SIGKILL once the grace period is over, for
+// Linux builds of the presence core. Both run in order on a worker thread, so the caller never waits on a spawn or
+// a grace period. Children are left running when the backend goes away; exited ones are reaped on every round.
+class posix_action_backend : public action_backend {
+public:
+    explicit posix_action_backend(process_selector& selector) : selector_(selector) {}
+
+    // Whatever was already requested still runs, so a kill made during teardown is not lost
+    ~posix_action_backend() {
+        {
+            std::lock_guard lock(mutex_);
+            stopping_ = true;
+        }
+        wake_.notify_all();
+        if(worker_.joinable())
+            worker_.join();
+    }
+
+    posix_action_backend(const posix_action_backend&) = delete;
+    posix_action_backend& operator=(const posix_action_backend&) = delete;
+
+    void set_start_entries(const std::vector<std::pair<std::string, std::string>>& entries) override {
+        std::lock_guard lock(mutex_);
+        entries_ = entries;
+        matchers_.clear();
+        // /proc reports resolved paths, so e.g. /bin/sleep has to be matched as /usr/bin/sleep
+        for(const auto& [path, args] : entries) {
+            std::error_code ec;
+            auto resolved = std::filesystem::weakly_canonical(path, ec);
+            matchers_.emplace_back(std::vector<std::wstring> { ec ? s2ws(path) : resolved.wstring() });
+        }
+    }
+
+    // The round uses the entries current when it runs, so one requested before a reload launches the new list
+    void start() override {
+        {
+            std::lock_guard lock(mutex_);
+            if(entries_.empty())
+                return;
+        }
+        post([this]() { launch_all(); });
+    }
+
+    // SIGTERM goes out right away; the grace period and SIGKILL are left to the worker
+    void kill(const std::vector<uint32_t>& pids, std::chrono::milliseconds grace) override {
+        auto start = std::chrono::steady_clock::now();
+
+        std::vector<pid_t> pending;
+        for(uint32_t pid : pids)
+            if(::kill(static_cast<pid_t>(pid), SIGTERM) == 0)
+                pending.push_back(static_cast<pid_t>(pid));
+
+        post([this, pending = std::move(pending), start, deadline = start + grace]() mutable {
+            finish_kill(pending, start, deadline);
+        });
+    }
+
+    void set_start_histogram(metrics_registry::histogram* histogram) override {
+        round_histogram_ = histogram;
+    }
+
+    void set_kill_histogram(metrics_registry::histogram* histogram) override {
+        kill_histogram_ = histogram;
+    }
+
+private:
+    void post(std::function<void()> job) {
+        {
+            std::lock_guard lock(mutex_);
+            jobs_.push_back(std::move(job));
+            if(!worker_.joinable())
+                worker_ = std::thread([this]() { run(); });
+        }
+        wake_.notify_one();
+    }
+
+    void run() {
+        std::unique_lock lock(mutex_);
+        while(true) {
+            wake_.wait(lock, [this]() { return stopping_ || !jobs_.empty(); });
+            if(jobs_.empty())
+                break;
+
+            auto job = std::move(jobs_.front());
+            jobs_.pop_front();
+            lock.unlock();
+            job();
+            lock.lock();
+        }
+    }
+
+    // Worker thread only
+    void launch_all() {
+        std::vector<std::pair<std::string, std::string>> entries;
+        std::vector<process_matcher> matchers;
+        {
+            std::lock_guard lock(mutex_);
+            entries = entries_;
+            matchers = matchers_;
+        }
+
+        auto start = std::chrono::steady_clock::now();
+        reap();
+
+        // A child shows up in /proc as soon as it is spawned, so no separate record of what we own is needed
+        std::vector<bool> running;
+        selector_.match_each(matchers, running);
+        for(size_t i = 0; i < entries.size(); i++)
+            if(!running[i])
+                launch(entries[i].first, entries[i].second);
+
+        if(round_histogram_)
+            round_histogram_->record_since(start);
+    }
+
+    // Worker thread only
+    void finish_kill(std::vector<pid_t>& pending, std::chrono::steady_clock::time_point start,
+                     std::chrono::steady_clock::time_point deadline) {
+        while(!pending.empty() && std::chrono::steady_clock::now() < deadline) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(20));
+            std::erase_if(pending, [](pid_t pid) { return !alive(pid); });
+        }
+
+        for(pid_t pid : pending)
+            ::kill(pid, SIGKILL);
+
+        reap();
+        if(kill_histogram_)
+            kill_histogram_->record_since(start);
+    }
+
+    // Arguments are split on spaces, as the config joins them with spaces
+    void launch(const std::string& path, const std::string& args) {
+        std::vector<std::string> argv { path };
+        std::istringstream in(args);
+        for(std::string arg; in >> arg;)
+            argv.push_back(std::move(arg));
+
+        std::vector<char*> raw;
+        for(auto& a : argv)
+            raw.push_back(a.data());
+        raw.push_back(nullptr);
+
+        posix_spawn_file_actions_t actions;
+        posix_spawn_file_actions_init(&actions);
+        auto dir = std::filesystem::path(path).parent_path();
+        if(!dir.empty())
+            posix_spawn_file_actions_addchdir_np(&actions, dir.c_str());
+
+        pid_t pid;
+        if(posix_spawn(&pid, path.c_str(), &actions, nullptr, raw.data(), environ) == 0)
+            children_.push_back(pid);
+        posix_spawn_file_actions_destroy(&actions);
+    }
+
+    void reap() {
+        std::erase_if(children_, [](pid_t pid) { return waitpid(pid, nullptr, WNOHANG) != 0; });
+    }
+
+    // Zombies count as gone; our own children among them are reaped afterwards
+    static bool alive(pid_t pid) {
+        char path[32];
+        std::snprintf(path, sizeof(path), "/proc/%d/stat", static_cast<int>(pid));
+        FILE* f = std::fopen(path, "r");
+        if(!f)
+            return false;
+
+        char buf[512];
+        size_t len = std::fread(buf, 1, sizeof(buf) - 1, f);
+        std::fclose(f);
+        buf[len] = '\0';
+
+        const char* p = std::strrchr(buf, ')');
+        return p && p[1] == ' ' && p[2] != 'Z' && p[2] != 'X';
+    }
+
+    process_selector& selector_;
+    metrics_registry::histogram* round_histogram_ = nullptr;
+    metrics_registry::histogram* kill_histogram_ = nullptr;
+
+    std::mutex mutex_;
+    std::condition_variable wake_;
+    std::thread worker_;
+    std::deque<std::function<void()>> jobs_;
+    bool stopping_ = false;
+
+    std::vector<std::pair<std::string, std::string>> entries_;
+    std::vector<process_matcher> matchers_;
+
+    // Worker thread only
+    std::vector<pid_t> children_;
+};
@@ -0,0 +1,50 @@
+#pragma once
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <cstddef>
+#include <filesystem>
+
+// Read-write shared mapping of the start of a file, which is created or grown to the requested size, for Linux
+// builds of the presence core. Writes reach the page cache directly, so they survive the process ending.
+class posix_mapped_file {
+public:
+    posix_mapped_file(const std::filesystem::path& path, size_t size) {
+        fd_ = open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+        if(fd_ < 0)
+            return;
+
+        struct stat st;
+        if(fstat(fd_, &st) != 0 || (static_cast<size_t>(st.st_size) < size && ftruncate(fd_, static_cast<off_t>(size)) != 0))
+            return;
+
+        void* data = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+        if(data == MAP_FAILED)
+            return;
+
+        data_ = data;
+        size_ = size;
+    }
+
+    ~posix_mapped_file() {
+        if(data_) {
+            msync(data_, size_, MS_ASYNC);
+            munmap(data_, size_);
+        }
+        if(fd_ >= 0)
+            close(fd_);
+    }
+
+    posix_mapped_file(const posix_mapped_file&) = delete;
+    posix_mapped_file& operator=(const posix_mapped_file&) = delete;
+
+    [[nodiscard]] void* data() const { return data_; }
+    [[nodiscard]] size_t size() const { return size_; }
+    explicit operator bool() const { return data_ != nullptr; }
+
+private:
+    int fd_ = -1;
+    void* data_ = nullptr;
+    size_t size_ = 0;
+};
@@ -0,0 +1,235 @@
+#pragma once
+#include <bitset>
+#include <cctype>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Fuses boolean presence sensors into a single presence state. Each sensor owns one bit of the state mask and
+// the presence rule is compiled into a lookup table indexed by that mask, so a sensor update is a bit flip and a
+// table lookup regardless of how many sensors or how complex the rule is.
+//
+// Rules combine sensor names with '|', '&', '!' and parentheses, e.g. "(user | sound) & !locked". An empty
+// rule means present while any sensor is.
+class presence_engine {
+public:
+    static constexpr size_t max_sensors = 8;
+
+    using sensor_id = size_t;
+    using mask = uint32_t;
+    using sensor_handler = std::function<void(sensor_id, bool)>;
+    using presence_handler = std::function<void(bool)>;
+
+    // Every sensor has to be added before the first update.
+    sensor_id add_sensor(std::string name) {
+        std::lock_guard lock(mutex_);
+        if(names_.size() >= max_sensors)
+            throw std::length_error("too many presence sensors");
+
+        names_.push_back(std::move(name));
+        compile(rule_);
+        return names_.size() - 1;
+    }
+
+    // Returns false, keeping the current rule, if the rule does not parse or names an unknown sensor.
+    bool set_rule(std::string rule) {
+        bool changed, present;
+        {
+            std::lock_guard lock(mutex_);
+            if(!compile(rule))
+                return false;
+
+            rule_ = std::move(rule);
+            changed = evaluate(present);
+        }
+
+        if(changed && on_presence_)
+            on_presence_(present);
+        return true;
+    }
+
+    // Called on the updating thread, outside of the engine's lock, so handlers may query the engine.
+    void on_sensor_change(sensor_handler handler) { on_sensor_ = std::move(handler); }
+    void on_presence_change(presence_handler handler) { on_presence_ = std::move(handler); }
+
+    void set(sensor_id sensor, bool value) {
+        bool changed, present;
+        {
+            std::lock_guard lock(mutex_);
+            const mask bit = mask(1) << sensor;
+            if(((state_ & bit) != 0) == value)
+                return;
+
+            state_ ^= bit;
+            changed = evaluate(present);
+        }
+
+        if(on_sensor_)
+            on_sensor_(sensor, value);
+        if(changed && on_presence_)
+            on_presence_(present);
+    }
+
+    // Names never change once added, so they can be read without locking
+    [[nodiscard]] const std::string& name(sensor_id sensor) const {
+        return names_[sensor];
+    }
+
+    [[nodiscard]] size_t sensor_count() const {
+        return names_.size();
+    }
+
+    [[nodiscard]] bool sensor(sensor_id sensor) const {
+        std::lock_guard lock(mutex_);
+        return (state_ >> sensor) & 1;
+    }
+
+    [[nodiscard]] bool present() const {
+        std::lock_guard lock(mutex_);
+        return present_;
+    }
+
+    [[nodiscard]] mask state() const {
+        std::lock_guard lock(mutex_);
+        return state_;
+    }
+
+private:
+    enum class op : uint8_t {
+        SENSOR,
+        NOT,
+        AND,
+        OR
+    };
+
+    struct instruction {
+        op code;
+        uint8_t sensor;
+    };
+
+    bool evaluate(bool& present) {
+        bool next = table_[state_];
+        bool changed = next != present_;
+        present_ = present = next;
+        return changed;
+    }
+
+    // Parses the rule into postfix form, then fills the table by running it once for every possible mask.
+    bool compile(std::string_view rule) {
+        size_t pos = 0;
+        skip_space(rule, pos);
+        if(pos == rule.size()) {
+            for(mask m = 0; m < (mask(1) << max_sensors); m++)
+                table_[m] = m != 0;
+            return true;
+        }
+
+        std::vector<instruction> program;
+        if(!parse_or(rule, pos, program))
+            return false;
+        skip_space(rule, pos);
+        if(pos != rule.size())
+            return false;
+
+        std::vector<bool> stack;
+        for(mask m = 0; m < (mask(1) << max_sensors); m++) {
+            stack.clear();
+            for(const auto& in : program) {
+                switch(in.code) {
+                case op::SENSOR: stack.push_back((m >> in.sensor) & 1); break;
+                case op::NOT: stack.back() = !stack.back(); break;
+                case op::AND: { bool b = stack.back(); stack.pop_back(); stack.back() = stack.back() && b; } break;
+                case op::OR: { bool b = stack.back(); stack.pop_back(); stack.back() = stack.back() || b; } break;
+                }
+            }
+            table_[m] = stack.back();
+        }
+
+        return true;
+    }
+
+    static void skip_space(std::string_view s, size_t& pos) {
+        while(pos < s.size() && std::isspace(static_cast<unsigned char>(s[pos])))
+            pos++;
+    }
+
+    bool parse_or(std::string_view s, size_t& pos, std::vector<instruction>& out) const {
+        if(!parse_and(s, pos, out))
+            return false;
+        while(true) {
+            skip_space(s, pos);
+            if(pos >= s.size() || s[pos] != '|')
+                return true;
+            pos++;
+            if(!parse_and(s, pos, out))
+                return false;
+            out.push_back({ op::OR, 0 });
+        }
+    }
+
+    bool parse_and(std::string_view s, size_t& pos, std::vector<instruction>& out) const {
+        if(!parse_not(s, pos, out))
+            return false;
+        while(true) {
+            skip_space(s, pos);
+            if(pos >= s.size() || s[pos] != '&')
+                return true;
+            pos++;
+            if(!parse_not(s, pos, out))
+                return false;
+            out.push_back({ op::AND, 0 });
+        }
+    }
+
+    bool parse_not(std::string_view s, size_t& pos, std::vector<instruction>& out) const {
+        skip_space(s, pos);
+        if(pos >= s.size())
+            return false;
+
+        if(s[pos] == '!') {
+            pos++;
+            if(!parse_not(s, pos, out))
+                return false;
+            out.push_back({ op::NOT, 0 });
+            return true;
+        }
+
+        if(s[pos] == '(') {
+            pos++;
+            if(!parse_or(s, pos, out))
+                return false;
+            skip_space(s, pos);
+            if(pos >= s.size() || s[pos] != ')')
+                return false;
+            pos++;
+            return true;
+        }
+
+        size_t start = pos;
+        while(pos < s.size() && (std::isalnum(static_cast<unsigned char>(s[pos])) || s[pos] == '_'))
+            pos++;
+        auto name = s.substr(start, pos - start);
+        for(size_t i = 0; i < names_.size(); i++) {
+            if(names_[i] == name) {
+                out.push_back({ op::SENSOR, static_cast<uint8_t>(i) });
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    mutable std::mutex mutex_;
+    std::vector<std::string> names_;
+    std::string rule_;
+    std::bitset<(1 << max_sensors)> table_;
+    mask state_ = 0;
+    bool present_ = false;
+
+    sensor_handler on_sensor_;
+    presence_handler on_presence_;
+};
@@ -0,0 +1,165 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "AudioSource.h"
+#include "ProcfsProcessInventory.h"
+
+// Open playback streams from /proc/asound, for Linux builds of the presence core. Every running playback
+// substream is a session owned by the process that opened it, reported at full peak since the kernel exposes no
+// meters. Under PipeWire or PulseAudio the owner is the sound server, so volumeProcesses has to name it rather
+// than the application playing.
+//
+// There are no notifications either, so a watcher thread looks for a running substream once a second and
+// reports the source idle while there is none, which spares the meter readings in between. It lists the cards
+// again every rescan_interval, picking up ones plugged in after startup.
+class proc_asound_audio_source : public audio_source {
+public:
+    static constexpr std::chrono::seconds watch_interval { 1 };
+    static constexpr std::chrono::seconds rescan_interval { 30 };
+
+    proc_asound_audio_source() {
+        status_paths_ = scan();
+        running_ = any_running();
+        watcher_ = std::thread([this]() { watch(); });
+    }
+
+    ~proc_asound_audio_source() {
+        {
+            std::lock_guard lock(mutex_);
+            stopping_ = true;
+        }
+        stop_.notify_all();
+        watcher_.join();
+    }
+
+    proc_asound_audio_source(const proc_asound_audio_source&) = delete;
+    proc_asound_audio_source& operator=(const proc_asound_audio_source&) = delete;
+
+    void sample(std::vector<audio_session_sample>& out) override {
+        out.clear();
+        std::lock_guard lock(mutex_);
+        for(const auto& path : status_paths_) {
+            uint32_t pid;
+            if(!read_status(path, pid))
+                continue;
+
+            uint64_t start_time = 0;
+            processes_.process_start_time(pid, start_time);
+            out.push_back({ pid, start_time, 1.f });
+        }
+    }
+
+    bool process_path(uint32_t pid, std::wstring& out) override {
+        return processes_.process_path(pid, out);
+    }
+
+    // Lags a substream starting or stopping by up to watch_interval
+    bool idle() override {
+        return !running_;
+    }
+
+    void set_wake_handler(std::function<void()> handler) override {
+        std::lock_guard lock(mutex_);
+        wake_ = std::move(handler);
+    }
+
+private:
+    static std::vector<std::string> scan() {
+        std::vector<std::string> paths;
+        std::error_code ec;
+        for(const auto& card : std::filesystem::directory_iterator("/proc/asound", ec)) {
+            if(!card.path().filename().string().starts_with("card"))
+                continue;
+
+            for(const auto& pcm : std::filesystem::directory_iterator(card.path(), ec)) {
+                auto name = pcm.path().filename().string();
+                if(!name.starts_with("pcm") || !name.ends_with("p"))
+                    continue;
+
+                for(const auto& sub : std::filesystem::directory_iterator(pcm.path(), ec))
+                    if(sub.path().filename().string().starts_with("sub"))
+                        paths.push_back((sub.path() / "status").string());
+            }
+        }
+        return paths;
+    }
+
+    // Expects mutex_ to be held
+    bool any_running() {
+        uint32_t pid;
+        for(const auto& path : status_paths_)
+            if(read_status(path, pid))
+                return true;
+        return false;
+    }
+
+    void watch() {
+        auto next_scan = std::chrono::steady_clock::now() + rescan_interval;
+        std::unique_lock lock(mutex_);
+        while(!stop_.wait_for(lock, watch_interval, [this]() { return stopping_; })) {
+            if(std::chrono::steady_clock::now() >= next_scan) {
+                // Listed without the lock, so sampling never waits on the directory walk
+                lock.unlock();
+                auto paths = scan();
+                lock.lock();
+                status_paths_ = std::move(paths);
+                next_scan = std::chrono::steady_clock::now() + rescan_interval;
+            }
+
+            bool running = any_running();
+            if(running && !running_.exchange(true) && wake_) {
+                auto wake = wake_;
+                lock.unlock();
+                wake();
+                lock.lock();
+            } else if(!running) {
+                running_ = false;
+            }
+        }
+    }
+
+    // A status file reads "closed" unless the substream is open, and then starts with "state: RUNNING" while playing.
+    // Expects mutex_ to be held, as the buffer is shared.
+    bool read_status(const std::string& path, uint32_t& pid) {
+        FILE* f = std::fopen(path.c_str(), "r");
+        if(!f)
+            return false;
+
+        size_t len = std::fread(buffer_, 1, sizeof(buffer_) - 1, f);
+        std::fclose(f);
+        buffer_[len] = '\0';
+
+        if(!std::strstr(buffer_, "state: RUNNING"))
+            return false;
+
+        const char* owner = std::strstr(buffer_, "owner_pid");
+        if(!owner || !(owner = std::strchr(owner, ':')))
+            return false;
+
+        pid = static_cast<uint32_t>(std::strtoul(owner + 1, nullptr, 10));
+        return pid != 0;
+    }
+
+    procfs_process_inventory processes_;
+
+    std::mutex mutex_;
+    std::condition_variable stop_;
+    std::thread watcher_;
+    bool stopping_ = false;
+    std::atomic<bool> running_ = false;
+    std::function<void()> wake_;
+    std::vector<std::string> status_paths_;
+    char buffer_[1024];
+};
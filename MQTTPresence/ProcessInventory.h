@@ -0,0 +1,138 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "ProcessMatcher.h"
+
+struct process_entry {
+    uint32_t pid;
+    uint32_t parent_pid;
+    std::wstring name; // image file name with extension, available without opening the process
+};
+
+// Platform source of running processes. Snapshots must be cheap and must not require opening processes.
+class process_inventory {
+public:
+    virtual ~process_inventory() = default;
+
+    // Replaces out with every running process. Implementations should reuse existing entries (and their
+    // string buffers) so repeated snapshots do not reallocate once warmed up.
+    virtual bool snapshot(std::vector<process_entry>& out) = 0;
+
+    // Slow path, only used when a pattern needs the full image path.
+    virtual bool process_path(uint32_t pid, std::wstring& out) = 0;
+
+    // Slow path, only used to reject children whose parent PID was reused.
+    virtual bool process_start_time(uint32_t pid, uint64_t& out) = 0;
+};
+
+// Picks the processes matching a process_matcher out of an inventory snapshot, filtering on the file name
+// first so that only candidates ever get opened, and optionally extends the selection to their descendants.
+class process_selector {
+public:
+    explicit process_selector(std::unique_ptr<process_inventory> inventory)
+        : inventory_(std::move(inventory)) {}
+
+    // Returns the selected PIDs in ascending order. The reference stays valid until the next call.
+    const std::vector<uint32_t>& select(const process_matcher& matcher, bool include_children) {
+        std::lock_guard lock(mutex_);
+
+        selected_.clear();
+        if(matcher.empty() || !inventory_->snapshot(entries_))
+            return selected_;
+
+        for(const auto& e : entries_) {
+            if(matcher.matches(e.name))
+                selected_.push_back(e.pid);
+            else if(matcher.needs_path(e.name) && inventory_->process_path(e.pid, path_) && matcher.matches(e.name, path_))
+                selected_.push_back(e.pid);
+        }
+
+        if(include_children && !selected_.empty())
+            add_descendants();
+
+        std::sort(selected_.begin(), selected_.end());
+        selected_.erase(std::unique(selected_.begin(), selected_.end()), selected_.end());
+        return selected_;
+    }
+
+    // Sets running[i] if any process matches matchers[i], from a single snapshot.
+    void match_each(const std::vector<process_matcher>& matchers, std::vector<bool>& running) {
+        std::lock_guard lock(mutex_);
+
+        running.assign(matchers.size(), false);
+        if(matchers.empty() || !inventory_->snapshot(entries_))
+            return;
+
+        for(const auto& e : entries_) {
+            int path_state = 0; // 0 not queried yet, 1 available, -1 unavailable
+            for(size_t i = 0; i < matchers.size(); i++) {
+                if(running[i])
+                    continue;
+
+                if(matchers[i].matches(e.name))
+                    running[i] = true;
+                else if(matchers[i].needs_path(e.name)) {
+                    if(path_state == 0)
+                        path_state = inventory_->process_path(e.pid, path_) ? 1 : -1;
+                    running[i] = path_state > 0 && matchers[i].matches(e.name, path_);
+                }
+            }
+        }
+    }
+
+    [[nodiscard]] size_t last_snapshot_size() const {
+        std::lock_guard lock(mutex_);
+        return entries_.size();
+    }
+
+private:
+    void add_descendants() {
+        by_parent_.resize(entries_.size());
+        for(size_t i = 0; i < entries_.size(); i++)
+            by_parent_[i] = i;
+        std::sort(by_parent_.begin(), by_parent_.end(), [this](size_t a, size_t b) {
+            return entries_[a].parent_pid < entries_[b].parent_pid;
+        });
+
+        // selected_ doubles as the BFS queue
+        for(size_t q = 0; q < selected_.size(); q++) {
+            const uint32_t parent = selected_[q];
+            auto first = std::lower_bound(by_parent_.begin(), by_parent_.end(), parent, [this](size_t i, uint32_t pid) {
+                return entries_[i].parent_pid < pid;
+            });
+
+            uint64_t parent_start = 0;
+            bool parent_known = false;
+            for(auto it = first; it != by_parent_.end() && entries_[*it].parent_pid == parent; ++it) {
+                const uint32_t child = entries_[*it].pid;
+                if(child == parent || std::find(selected_.begin(), selected_.end(), child) != selected_.end())
+                    continue;
+
+                // A child cannot predate its parent; if it does, the parent PID was recycled
+                if(!parent_known) {
+                    parent_known = true;
+                    if(!inventory_->process_start_time(parent, parent_start))
+                        parent_start = 0;
+                }
+                uint64_t child_start;
+                if(parent_start != 0 && inventory_->process_start_time(child, child_start) && child_start < parent_start)
+                    continue;
+
+                selected_.push_back(child);
+            }
+        }
+    }
+
+    std::unique_ptr<process_inventory> inventory_;
+
+    mutable std::mutex mutex_;
+    std::vector<process_entry> entries_;
+    std::vector<size_t> by_parent_;
+    std::vector<uint32_t> selected_;
+    std::wstring path_;
+};
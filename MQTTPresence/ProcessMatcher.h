@@ -0,0 +1,152 @@
+#pragma once
+#include <cstdint>
+#include <cwctype>
+#include <string>
+#include <string_view>
+#include <unordered_set>
+#include <vector>
+
+// Matches processes against a list of patterns, compiled once from the configuration:
+//  - "firefox.exe"                   case-insensitive exact file name
+//  - "chrome*.exe", "game??.exe"     case-insensitive glob over the file name
+//  - "C:\Games\*\*.exe"              case-insensitive glob over the full image path (any pattern with a separator)
+// Matching never allocates; case folding happens character by character.
+class process_matcher {
+public:
+    process_matcher() = default;
+
+    explicit process_matcher(const std::vector<std::wstring>& patterns) {
+        for(const auto& p : patterns)
+            add(p);
+    }
+
+    void add(std::wstring_view pattern) {
+        if(pattern.empty())
+            return;
+
+        std::wstring folded(pattern.size(), L'\0');
+        for(size_t i = 0; i < pattern.size(); i++)
+            folded[i] = fold(pattern[i]);
+
+        if(folded.find(L'\\') != std::wstring::npos)
+            path_globs_.push_back(std::move(folded));
+        else if(folded.find_first_of(L"*?") != std::wstring::npos)
+            name_globs_.push_back(std::move(folded));
+        else
+            exact_.insert(std::move(folded));
+    }
+
+    [[nodiscard]] bool empty() const {
+        return exact_.empty() && name_globs_.empty() && path_globs_.empty();
+    }
+
+    [[nodiscard]] bool has_path_patterns() const {
+        return !path_globs_.empty();
+    }
+
+    // Whether a process with this file name could still match a path pattern, i.e. whether its full path
+    // is worth looking up. Path patterns with a literal file name rule out every other name up front.
+    [[nodiscard]] bool needs_path(std::wstring_view name) const {
+        for(const auto& g : path_globs_) {
+            auto last = file_name(g);
+            if(last.find_first_of(L"*?") != std::wstring_view::npos || glob(last, name))
+                return true;
+        }
+
+        return false;
+    }
+
+    // Either argument may be empty if unknown; path patterns can only match when a path is given.
+    [[nodiscard]] bool matches(std::wstring_view name, std::wstring_view path = {}) const {
+        if(name.empty())
+            name = file_name(path);
+
+        if(!name.empty()) {
+            if(exact_.find(name) != exact_.end())
+                return true;
+
+            for(const auto& g : name_globs_)
+                if(glob(g, name))
+                    return true;
+        }
+
+        if(!path.empty()) {
+            for(const auto& g : path_globs_)
+                if(glob(g, path))
+                    return true;
+        }
+
+        return false;
+    }
+
+    // Same as matches(), with the file name taken from the path.
+    [[nodiscard]] bool matches_path(std::wstring_view path) const {
+        return matches(file_name(path), path);
+    }
+
+    static std::wstring_view file_name(std::wstring_view path) {
+        auto sep = path.find_last_of(L"\\/");
+        return sep == std::wstring_view::npos ? path : path.substr(sep + 1);
+    }
+
+private:
+    static wchar_t fold(wchar_t c) {
+        if(c == L'/')
+            return L'\\';
+        if(c < 0x80)
+            return (c >= L'A' && c <= L'Z') ? static_cast<wchar_t>(c - L'A' + L'a') : c;
+        return static_cast<wchar_t>(std::towlower(c));
+    }
+
+    // Iterative wildcard match; backtracks to the most recent '*' only, so it is linear in practice.
+    static bool glob(std::wstring_view pattern, std::wstring_view text) {
+        size_t p = 0, t = 0;
+        size_t star = std::wstring_view::npos, star_t = 0;
+        while(t < text.size()) {
+            if(p < pattern.size() && (pattern[p] == L'?' || pattern[p] == fold(text[t]))) {
+                p++;
+                t++;
+            } else if(p < pattern.size() && pattern[p] == L'*') {
+                star = p++;
+                star_t = t;
+            } else if(star != std::wstring_view::npos) {
+                p = star + 1;
+                t = ++star_t;
+            } else
+                return false;
+        }
+
+        while(p < pattern.size() && pattern[p] == L'*')
+            p++;
+
+        return p == pattern.size();
+    }
+
+    struct folded_hash {
+        using is_transparent = void;
+
+        size_t operator()(std::wstring_view s) const {
+            uint64_t h = 14695981039346656037ull;
+            for(auto c : s)
+                h = (h ^ static_cast<uint64_t>(fold(c))) * 1099511628211ull;
+            return static_cast<size_t>(h);
+        }
+    };
+
+    struct folded_equal {
+        using is_transparent = void;
+
+        bool operator()(std::wstring_view a, std::wstring_view b) const {
+            if(a.size() != b.size())
+                return false;
+            for(size_t i = 0; i < a.size(); i++)
+                if(fold(a[i]) != fold(b[i]))
+                    return false;
+            return true;
+        }
+    };
+
+    std::unordered_set<std::wstring, folded_hash, folded_equal> exact_;
+    std::vector<std::wstring> name_globs_;
+    std::vector<std::wstring> path_globs_;
+};
@@ -0,0 +1,75 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+
+// Identifies a process instance. The start time disambiguates a PID that has been reused.
+struct process_key {
+    uint32_t pid;
+    uint64_t start_time;
+
+    bool operator==(const process_key&) const = default;
+};
+
+struct process_key_hash {
+    size_t operator()(const process_key& k) const {
+        return std::hash<uint64_t>()(k.start_time ^ (static_cast<uint64_t>(k.pid) * 0x9E3779B97F4A7C15ull));
+    }
+};
+
+// Maps process instances to their image paths. Entries are marked as seen once per sweep generation
+// and anything not seen since the previous sweep belongs to a process that went away, so it is evicted.
+class process_name_cache {
+public:
+    struct stats {
+        uint64_t hits;
+        uint64_t misses;
+        uint64_t evictions;
+        size_t size;
+    };
+
+    const std::wstring* find(const process_key& key) {
+        auto it = entries_.find(key);
+        if(it == entries_.end()) {
+            misses_++;
+            return nullptr;
+        }
+
+        hits_++;
+        it->second.generation = generation_;
+        return &it->second.name;
+    }
+
+    const std::wstring& insert(const process_key& key, std::wstring name) {
+        auto& e = entries_[key];
+        e.name = std::move(name);
+        e.generation = generation_;
+        return e.name;
+    }
+
+    // Marks a process as still alive without counting towards hits or misses.
+    void touch(const process_key& key) {
+        auto it = entries_.find(key);
+        if(it != entries_.end())
+            it->second.generation = generation_;
+    }
+
+    void sweep() {
+        evictions_ += std::erase_if(entries_, [this](const auto& e) { return e.second.generation != generation_; });
+        generation_++;
+    }
+
+    [[nodiscard]] stats get_stats() const {
+        return { hits_, misses_, evictions_, entries_.size() };
+    }
+
+private:
+    struct entry {
+        std::wstring name;
+        uint64_t generation;
+    };
+
+    std::unordered_map<process_key, entry, process_key_hash> entries_;
+    uint64_t generation_ = 0;
+    uint64_t hits_ = 0, misses_ = 0, evictions_ = 0;
+};
@@ -0,0 +1,219 @@
+#pragma once
+#include <windows.h>
+#include <chrono>
+#include <condition_variable>
+#include <filesystem>
+#include <format>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "MQTTPresence.h"
+#include "Metrics.h"
+#include "ProcessInventory.h"
+#include "ProcessMatcher.h"
+
+// Launches the configured startProcesses off the caller's thread and keeps track of the children it owns.
+// Anything already running (whether ours or started by the user) is not launched again, and exited
+// children are reaped so their handles do not accumulate across presence changes.
+class process_supervisor {
+public:
+    struct stats {
+        uint64_t launched;
+        uint64_t skipped;
+        uint64_t failed;
+        uint64_t reaped;
+        size_t children;
+        std::chrono::microseconds last_latency;
+        std::chrono::microseconds max_latency;
+    };
+
+    explicit process_supervisor(process_selector& selector) : selector_(selector) {}
+
+    ~process_supervisor() {
+        {
+            std::lock_guard lock(mutex_);
+            stopping_ = true;
+        }
+        wake_.notify_all();
+        if(worker_.joinable())
+            worker_.join();
+
+        // Children are left running; only our handles to them are released
+        for(auto& c : children_)
+            CloseHandle(c.process);
+    }
+
+    process_supervisor(const process_supervisor&) = delete;
+    process_supervisor& operator=(const process_supervisor&) = delete;
+
+    void set_entries(const std::vector<std::pair<std::string, std::string>>& entries) {
+        std::lock_guard lock(mutex_);
+        entries_.clear();
+        matchers_.clear();
+        generation_++;
+        // Children from the previous list are still reaped, but no longer stand in for any entry
+        for(auto& c : children_)
+            c.entry = no_entry;
+        for(const auto& [path, args] : entries) {
+            entries_.push_back({ path, args });
+            matchers_.emplace_back(std::vector<std::wstring> { s2ws(path) });
+        }
+    }
+
+    // Receives the duration of every launch round; set before the first request.
+    void set_round_histogram(metrics_registry::histogram* histogram) {
+        round_histogram_ = histogram;
+    }
+
+    // Returns immediately; requests made while a launch round is in progress are coalesced into one more round.
+    void request_launch() {
+        {
+            std::lock_guard lock(mutex_);
+            if(entries_.empty())
+                return;
+            requested_ = true;
+            if(!worker_.joinable())
+                worker_ = std::thread([this]() { run(); });
+        }
+        wake_.notify_one();
+    }
+
+    [[nodiscard]] stats get_stats() const {
+        std::lock_guard lock(mutex_);
+        return { launched_, skipped_, failed_, reaped_, children_.size(), last_latency_, max_latency_ };
+    }
+
+private:
+    struct entry {
+        std::string path;
+        std::string args;
+    };
+
+    static constexpr size_t no_entry = static_cast<size_t>(-1);
+
+    struct child {
+        size_t entry;
+        HANDLE process;
+        DWORD pid;
+    };
+
+    void run() {
+        std::unique_lock lock(mutex_);
+        while(true) {
+            wake_.wait(lock, [this]() { return stopping_ || requested_; });
+            if(stopping_)
+                break;
+
+            requested_ = false;
+            auto entries = entries_;
+            auto matchers = matchers_;
+            auto generation = generation_;
+            lock.unlock();
+            auto start = std::chrono::steady_clock::now();
+            launch_all(entries, matchers, generation);
+            if(round_histogram_)
+                round_histogram_->record_since(start);
+            lock.lock();
+        }
+    }
+
+    void launch_all(const std::vector<entry>& entries, const std::vector<process_matcher>& matchers, uint64_t generation) {
+        reap();
+
+        std::vector<bool> running;
+        selector_.match_each(matchers, running);
+
+        std::vector<std::thread> launches;
+        for(size_t i = 0; i < entries.size(); i++) {
+            if(running[i] || owns_running(i)) {
+                std::lock_guard lock(mutex_);
+                skipped_++;
+                continue;
+            }
+
+            launches.emplace_back([this, i, &entries, generation]() { launch(i, entries[i], generation); });
+        }
+
+        for(auto& t : launches)
+            t.join();
+    }
+
+    void launch(size_t index, const entry& e, uint64_t generation) {
+        STARTUPINFOA startupinfo;
+        ZeroMemory(&startupinfo, sizeof(STARTUPINFOA));
+        startupinfo.cb = sizeof(STARTUPINFOA);
+        startupinfo.dwFlags = STARTF_USESHOWWINDOW;
+        startupinfo.wShowWindow = SW_HIDE;
+        PROCESS_INFORMATION pinfo;
+
+        auto start = std::chrono::steady_clock::now();
+        std::string cmdline = std::format("\"{}\" {}", e.path, e.args);
+        BOOL ok = CreateProcessA(
+            nullptr,
+            cmdline.data(),
+            nullptr,
+            nullptr,
+            false,
+            0,
+            nullptr,
+            std::filesystem::path(e.path).parent_path().string().c_str(),
+            &startupinfo,
+            &pinfo
+        );
+        auto latency = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start);
+
+        std::lock_guard lock(mutex_);
+        if(!ok) {
+            failed_++;
+            return;
+        }
+
+        CloseHandle(pinfo.hThread);
+        // The list may have been replaced while this round ran, in which case the index refers to the old one
+        children_.push_back({ generation == generation_ ? index : no_entry, pinfo.hProcess, pinfo.dwProcessId });
+        launched_++;
+        last_latency_ = latency;
+        if(latency > max_latency_)
+            max_latency_ = latency;
+    }
+
+    bool owns_running(size_t index) {
+        std::lock_guard lock(mutex_);
+        for(const auto& c : children_)
+            if(c.entry == index)
+                return true;
+
+        return false;
+    }
+
+    void reap() {
+        std::lock_guard lock(mutex_);
+        std::erase_if(children_, [this](const child& c) {
+            if(WaitForSingleObject(c.process, 0) != WAIT_OBJECT_0)
+                return false;
+
+            CloseHandle(c.process);
+            reaped_++;
+            return true;
+        });
+    }
+
+    process_selector& selector_;
+    metrics_registry::histogram* round_histogram_ = nullptr;
+
+    mutable std::mutex mutex_;
+    std::condition_variable wake_;
+    std::thread worker_;
+    bool requested_ = false, stopping_ = false;
+    uint64_t generation_ = 0;
+
+    std::vector<entry> entries_;
+    std::vector<process_matcher> matchers_;
+    std::vector<child> children_;
+
+    uint64_t launched_ = 0, skipped_ = 0, failed_ = 0, reaped_ = 0;
+    std::chrono::microseconds last_latency_ {}, max_latency_ {};
+};
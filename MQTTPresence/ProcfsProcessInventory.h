@@ -0,0 +1,118 @@
+#pragma once
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+#include "ProcessInventory.h"
+
+// Process snapshots from /proc, for Linux builds of the presence core.
+class procfs_process_inventory : public process_inventory {
+public:
+    bool snapshot(std::vector<process_entry>& out) override {
+        std::error_code ec;
+        std::filesystem::directory_iterator it("/proc", ec);
+        if(ec)
+            return false;
+
+        size_t count = 0;
+        for(const auto& dir : it) {
+            const auto file = dir.path().filename();
+            char* end = nullptr;
+            unsigned long pid = std::strtoul(file.c_str(), &end, 10);
+            if(file.empty() || *end != '\0')
+                continue;
+
+            uint32_t parent_pid;
+            uint64_t start;
+            if(!read_stat(static_cast<uint32_t>(pid), parent_pid, start))
+                continue;
+
+            if(count == out.size())
+                out.emplace_back();
+
+            auto& e = out[count++];
+            e.pid = static_cast<uint32_t>(pid);
+            e.parent_pid = parent_pid;
+            e.name.clear();
+            if(process_path(e.pid, path_))
+                e.name.assign(process_matcher::file_name(path_));
+            if(e.name.empty())
+                read_comm(e.pid, e.name);
+        }
+        out.resize(count);
+
+        return true;
+    }
+
+    bool process_path(uint32_t pid, std::wstring& out) override {
+        std::error_code ec;
+        auto exe = std::filesystem::read_symlink("/proc/" + std::to_string(pid) + "/exe", ec);
+        if(ec)
+            return false;
+
+        out = exe.wstring();
+        return !out.empty();
+    }
+
+    bool process_start_time(uint32_t pid, uint64_t& out) override {
+        uint32_t parent_pid;
+        return read_stat(pid, parent_pid, out);
+    }
+
+private:
+    // /proc/<pid>/stat is "pid (comm) state ppid ...", where comm may itself contain spaces and parentheses
+    static bool read_stat(uint32_t pid, uint32_t& parent_pid, uint64_t& start_time) {
+        char path[32];
+        std::snprintf(path, sizeof(path), "/proc/%u/stat", pid);
+        FILE* f = std::fopen(path, "r");
+        if(!f)
+            return false;
+
+        char buf[1024];
+        size_t len = std::fread(buf, 1, sizeof(buf) - 1, f);
+        std::fclose(f);
+        buf[len] = '\0';
+
+        const char* p = std::strrchr(buf, ')');
+        if(!p)
+            return false;
+
+        // Fields after comm: state(3) ppid(4) ... starttime(22)
+        unsigned long ppid = 0;
+        unsigned long long start = 0;
+        int field = 2;
+        for(const char* c = p + 1; *c; c++) {
+            if(*c != ' ')
+                continue;
+            field++;
+            if(field == 4)
+                ppid = std::strtoul(c + 1, nullptr, 10);
+            else if(field == 22) {
+                start = std::strtoull(c + 1, nullptr, 10);
+                break;
+            }
+        }
+
+        parent_pid = static_cast<uint32_t>(ppid);
+        start_time = start;
+        return field >= 4;
+    }
+
+    static void read_comm(uint32_t pid, std::wstring& out) {
+        char path[32];
+        std::snprintf(path, sizeof(path), "/proc/%u/comm", pid);
+        out.clear();
+        FILE* f = std::fopen(path, "r");
+        if(!f)
+            return;
+
+        for(int c = std::fgetc(f); c != EOF && c != '\n'; c = std::fgetc(f))
+            out.push_back(static_cast<wchar_t>(c));
+        std::fclose(f);
+    }
+
+    std::wstring path_;
+};
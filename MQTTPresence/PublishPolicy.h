@@ -0,0 +1,62 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+enum class message_class {
+    DISCOVERY = 0,
+    STATE = 1,
+    HEARTBEAT = 2,
+    AVAILABILITY = 3,
+    DIAGNOSTICS = 4,
+    HISTORY = 5,
+
+    COUNT
+};
+
+inline const char* message_class_name(message_class c) {
+    switch(c) {
+    case message_class::DISCOVERY: return "discovery";
+    case message_class::STATE: return "state";
+    case message_class::HEARTBEAT: return "heartbeat";
+    case message_class::AVAILABILITY: return "availability";
+    case message_class::DIAGNOSTICS: return "diagnostics";
+    case message_class::HISTORY: return "history";
+    default: return "";
+    }
+}
+
+struct publish_policy {
+    int qos;
+    bool retain;
+    uint32_t expiry = 0; // seconds, 0 means never; only honoured over MQTT 5
+
+    bool operator==(const publish_policy&) const = default;
+};
+
+using publish_policy_table = std::array<publish_policy, static_cast<size_t>(message_class::COUNT)>;
+
+inline publish_policy_table default_publish_policies() {
+    publish_policy_table t;
+    t[static_cast<size_t>(message_class::DISCOVERY)] = { 1, true };
+    t[static_cast<size_t>(message_class::STATE)] = { 1, true };
+    t[static_cast<size_t>(message_class::HEARTBEAT)] = { 0, true };
+    t[static_cast<size_t>(message_class::AVAILABILITY)] = { 1, true };
+    t[static_cast<size_t>(message_class::DIAGNOSTICS)] = { 0, false };
+    t[static_cast<size_t>(message_class::HISTORY)] = { 1, false };
+    return t;
+}
+
+inline const publish_policy& policy_for(const publish_policy_table& t, message_class c) {
+    return t[static_cast<size_t>(c)];
+}
+
+// Message expiry is an MQTT 5 property, so the connection is only upgraded when a policy asks for it.
+inline bool needs_mqtt5(const publish_policy_table& t) {
+    for(const auto& p : t)
+        if(p.expiry > 0)
+            return true;
+
+    return false;
+}
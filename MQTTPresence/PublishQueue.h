@@ -0,0 +1,228 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <mqtt/message.h>
+
+// Bounded, coalescing publish queue drained by a single sender thread.
+// Every topic owns one slot which only ever holds the latest message for that topic,
+// so a slow broker delays delivery but never causes stale intermediate states to be sent.
+// Each slot also remembers the last payload delivered, so unchanged values are not resent unless forced.
+class publish_queue {
+public:
+    using sender_t = std::function<bool(const mqtt::const_message_ptr& msg)>;
+    static constexpr size_t npos = static_cast<size_t>(-1);
+
+    struct stats {
+        size_t depth;
+        size_t high_water;
+        uint64_t enqueued;
+        uint64_t coalesced;
+        uint64_t suppressed;
+        uint64_t dropped;
+        uint64_t sent;
+        uint64_t failed;
+    };
+
+    publish_queue(size_t capacity, sender_t sender)
+        : sender_(std::move(sender))
+        , ring_(capacity) {
+        slots_.reserve(capacity);
+        slot_index_.reserve(capacity);
+        thread_ = std::thread([this]() { run(); });
+    }
+
+    ~publish_queue() {
+        stop();
+    }
+
+    publish_queue(const publish_queue&) = delete;
+    publish_queue& operator=(const publish_queue&) = delete;
+
+    // Reserves the slot for a topic up front so that enqueueing to it never needs to hash or allocate.
+    // Returns npos if the queue has no free slots left.
+    size_t register_topic(const std::string& topic) {
+        std::lock_guard lock(mutex_);
+        return slot_for(topic);
+    }
+
+    // Returns immediately. If a message for the same topic is still pending it is replaced.
+    // Unless force is set, a message identical to the last one delivered on its topic is skipped.
+    bool enqueue(mqtt::const_message_ptr msg, bool force = false) {
+        size_t slot_id;
+        {
+            std::lock_guard lock(mutex_);
+            slot_id = slot_for(msg->get_topic());
+        }
+        return enqueue(slot_id, std::move(msg), force);
+    }
+
+    bool enqueue(size_t slot_id, mqtt::const_message_ptr msg, bool force = false) {
+        {
+            std::lock_guard lock(mutex_);
+            if(stopping_ || slot_id >= slots_.size()) {
+                dropped_++;
+                return false;
+            }
+
+            auto& s = slots_[slot_id];
+            if(!force && !s.queued && same_payload(s.last_sent, msg)) {
+                suppressed_++;
+                return true;
+            }
+
+            enqueued_++;
+            s.pending = std::move(msg);
+            s.force = s.force || force;
+            if(s.queued) {
+                coalesced_++;
+                return true;
+            }
+
+            s.queued = true;
+            ring_[(head_ + count_) % ring_.size()] = slot_id;
+            count_++;
+            if(count_ > high_water_)
+                high_water_ = count_;
+        }
+        wake_.notify_one();
+        return true;
+    }
+
+    // Blocks until everything queued so far has been handed to the sender, or the timeout expires.
+    bool flush(std::chrono::milliseconds timeout) {
+        std::unique_lock lock(mutex_);
+        return idle_.wait_for(lock, timeout, [this]() { return count_ == 0 && !in_flight_; });
+    }
+
+    // While paused nothing is sent, but enqueueing still coalesces, so each topic keeps its latest value until resume().
+    void pause() {
+        std::lock_guard lock(mutex_);
+        paused_ = true;
+    }
+
+    void resume() {
+        {
+            std::lock_guard lock(mutex_);
+            paused_ = false;
+        }
+        wake_.notify_one();
+    }
+
+    // Stops accepting messages, discards anything still pending and joins the sender.
+    void stop() {
+        {
+            std::lock_guard lock(mutex_);
+            if(stopping_ && !thread_.joinable())
+                return;
+            stopping_ = true;
+        }
+        wake_.notify_all();
+        if(thread_.joinable())
+            thread_.join();
+    }
+
+    [[nodiscard]] stats get_stats() const {
+        std::lock_guard lock(mutex_);
+        return { count_, high_water_, enqueued_, coalesced_, suppressed_, dropped_, sent_, failed_ };
+    }
+
+    // Forgets what was last delivered, e.g. after the broker may have lost retained state.
+    void invalidate() {
+        std::lock_guard lock(mutex_);
+        for(auto& s : slots_)
+            s.last_sent.reset();
+    }
+
+private:
+    struct slot {
+        mqtt::const_message_ptr pending;
+        mqtt::const_message_ptr last_sent;
+        bool queued = false;
+        bool force = false;
+    };
+
+    size_t slot_for(const std::string& topic) {
+        auto it = slot_index_.find(topic);
+        if(it != slot_index_.end())
+            return it->second;
+        if(slots_.size() >= ring_.size())
+            return npos;
+
+        size_t slot_id = slots_.size();
+        slots_.emplace_back();
+        slot_index_.emplace(topic, slot_id);
+        return slot_id;
+    }
+
+    static bool same_payload(const mqtt::const_message_ptr& a, const mqtt::const_message_ptr& b) {
+        return a && b && (a == b || a->get_payload() == b->get_payload());
+    }
+
+    void run() {
+        std::unique_lock lock(mutex_);
+        while(true) {
+            wake_.wait(lock, [this]() { return stopping_ || (count_ > 0 && !paused_); });
+            if(stopping_)
+                break;
+
+            auto& s = slots_[ring_[head_]];
+            head_ = (head_ + 1) % ring_.size();
+            count_--;
+            s.queued = false;
+            auto msg = std::move(s.pending);
+            bool force = std::exchange(s.force, false);
+
+            if(force || !same_payload(s.last_sent, msg)) {
+                in_flight_ = true;
+
+                lock.unlock();
+                bool ok = sender_(msg);
+                lock.lock();
+
+                in_flight_ = false;
+                if(ok) {
+                    sent_++;
+                    s.last_sent = std::move(msg);
+                } else
+                    failed_++;
+            } else
+                suppressed_++;
+
+            if(count_ == 0)
+                idle_.notify_all();
+        }
+
+        dropped_ += count_;
+        for(auto& s : slots_) {
+            s.pending.reset();
+            s.queued = false;
+            s.force = false;
+        }
+        count_ = 0;
+        idle_.notify_all();
+    }
+
+    sender_t sender_;
+
+    mutable std::mutex mutex_;
+    std::condition_variable wake_, idle_;
+    std::unordered_map<std::string, size_t> slot_index_;
+    std::vector<slot> slots_; // reserved up front, so references stay valid while the lock is released
+    std::vector<size_t> ring_;
+    size_t head_ = 0, count_ = 0, high_water_ = 0;
+    bool in_flight_ = false, stopping_ = false, paused_ = false;
+
+    uint64_t enqueued_ = 0, coalesced_ = 0, suppressed_ = 0, dropped_ = 0, sent_ = 0, failed_ = 0;
+
+    std::thread thread_;
+};
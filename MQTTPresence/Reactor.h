@@ -0,0 +1,199 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <queue>
+#include <vector>
+
+// Single-threaded event loop: timers kept in a heap, tasks posted from any thread, and whatever wait objects
+// (handles, fds) the platform backend has registered. Everything runs on the thread calling run(), which only
+// wakes up when one of those is due, so an idle process does not wake at all.
+class reactor {
+public:
+    using clock = std::chrono::steady_clock;
+    using timer_id = uint64_t;
+    using task = std::function<void()>;
+
+    struct stats {
+        uint64_t wakeups;
+        uint64_t timers;
+        uint64_t tasks;
+    };
+
+    virtual ~reactor() = default;
+
+    // Thread-safe. A non-zero period makes the timer repeat until cancelled.
+    timer_id add_timer(clock::time_point due, task fn, clock::duration period = {}) {
+        timer_id id;
+        bool earliest;
+        {
+            std::lock_guard lock(mutex_);
+            id = ++last_timer_;
+            timers_.emplace(id, timer { due, period, std::move(fn) });
+            earliest = heap_.empty() || due < heap_.top().due;
+            heap_.push({ due, id });
+        }
+
+        if(earliest)
+            notify();
+        return id;
+    }
+
+    timer_id add_timer(clock::duration delay, task fn, clock::duration period = {}) {
+        return add_timer(clock::now() + delay, std::move(fn), period);
+    }
+
+    // Thread-safe, also from inside the timer's own callback. Cancelling an expired timer does nothing.
+    void cancel_timer(timer_id id) {
+        std::lock_guard lock(mutex_);
+        timers_.erase(id);
+    }
+
+    // Thread-safe; fn runs on the reactor thread.
+    void post(task fn) {
+        {
+            std::lock_guard lock(mutex_);
+            posted_.push_back(std::move(fn));
+        }
+        notify();
+    }
+
+    void run() {
+        while(true) {
+            run_posted();
+            run_timers();
+
+            std::optional<clock::duration> timeout;
+            {
+                std::lock_guard lock(mutex_);
+                if(stopping_)
+                    break;
+                drop_stale();
+                if(!posted_.empty())
+                    timeout = clock::duration::zero();
+                else if(!heap_.empty())
+                    timeout = std::max(heap_.top().due - clock::now(), clock::duration::zero());
+            }
+
+            wait(timeout);
+            wakeups_++;
+        }
+
+        std::lock_guard lock(mutex_);
+        stopping_ = false;
+    }
+
+    // Thread-safe; run() returns once the current callback finishes.
+    void stop() {
+        {
+            std::lock_guard lock(mutex_);
+            stopping_ = true;
+        }
+        notify();
+    }
+
+    [[nodiscard]] stats get_stats() const {
+        return { wakeups_, timers_run_, tasks_run_ };
+    }
+
+protected:
+    // Blocks until a wait object fires (dispatching it), notify() is called, or the timeout elapses.
+    // No timeout means wait indefinitely.
+    virtual void wait(std::optional<clock::duration> timeout) = 0;
+
+    // Thread-safe; makes a blocked or upcoming wait() return.
+    virtual void notify() = 0;
+
+    // Rounds up, so a wait never returns just before a timer is due and spins.
+    static uint32_t timeout_ms(clock::duration timeout) {
+        return static_cast<uint32_t>(std::chrono::ceil<std::chrono::milliseconds>(timeout).count());
+    }
+
+private:
+    struct timer {
+        clock::time_point due;
+        clock::duration period;
+        task fn;
+    };
+
+    struct heap_entry {
+        clock::time_point due;
+        timer_id id;
+
+        bool operator>(const heap_entry& o) const { return due > o.due; }
+    };
+
+    bool stale(const heap_entry& e) const {
+        auto it = timers_.find(e.id);
+        return it == timers_.end() || it->second.due != e.due;
+    }
+
+    // Cancelled and rescheduled timers leave their old heap entries behind; they must not cause wakeups
+    void drop_stale() {
+        while(!heap_.empty() && stale(heap_.top()))
+            heap_.pop();
+    }
+
+    void run_posted() {
+        {
+            std::lock_guard lock(mutex_);
+            if(posted_.empty())
+                return;
+            running_.swap(posted_);
+        }
+
+        for(auto& fn : running_) {
+            fn();
+            tasks_run_++;
+        }
+        running_.clear();
+    }
+
+    void run_timers() {
+        const auto now = clock::now();
+        while(true) {
+            task fn;
+            {
+                std::lock_guard lock(mutex_);
+                if(heap_.empty() || heap_.top().due > now)
+                    return;
+
+                auto [due, id] = heap_.top();
+                heap_.pop();
+
+                auto it = timers_.find(id);
+                if(it == timers_.end() || it->second.due != due)
+                    continue;
+
+                if(it->second.period > clock::duration::zero()) {
+                    fn = it->second.fn;
+                    // Missed periods are skipped rather than replayed back to back
+                    it->second.due = due + it->second.period;
+                    if(it->second.due <= now)
+                        it->second.due = now + it->second.period;
+                    heap_.push({ it->second.due, id });
+                } else {
+                    fn = std::move(it->second.fn);
+                    timers_.erase(it);
+                }
+            }
+
+            fn();
+            timers_run_++;
+        }
+    }
+
+    mutable std::mutex mutex_;
+    std::map<timer_id, timer> timers_;
+    std::priority_queue<heap_entry, std::vector<heap_entry>, std::greater<>> heap_;
+    std::vector<task> posted_, running_;
+    timer_id last_timer_ = 0;
+    bool stopping_ = false;
+
+    std::atomic<uint64_t> wakeups_ = 0, timers_run_ = 0, tasks_run_ = 0;
+};
@@ -0,0 +1,96 @@
+#pragma once
+#include <windows.h>
+#include <filesystem>
+#include <functional>
+#include <string>
+
+#include "FileWatch.h"
+#include "Win32Reactor.h"
+
+// File events from ReadDirectoryChangesW on the file's parent directory, matched against the file name.
+class read_directory_changes_watch : public file_watch_backend {
+public:
+    read_directory_changes_watch(win32_reactor& reactor, const std::filesystem::path& path)
+        : reactor_(reactor), name_(path.filename().wstring()) {
+        dir_ = CreateFileW(path.parent_path().c_str(), FILE_LIST_DIRECTORY,
+                           FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, nullptr, OPEN_EXISTING,
+                           FILE_FLAG_BACKUP_SEMANTICS | FILE_FLAG_OVERLAPPED, nullptr);
+        overlapped_.hEvent = CreateEvent(nullptr, true, false, nullptr);
+    }
+
+    ~read_directory_changes_watch() override {
+        if(started_)
+            reactor_.remove_handle(overlapped_.hEvent);
+        if(dir_ != INVALID_HANDLE_VALUE) {
+            if(pending_) {
+                CancelIoEx(dir_, &overlapped_);
+                DWORD bytes;
+                GetOverlappedResult(dir_, &overlapped_, &bytes, true);
+            }
+            CloseHandle(dir_);
+        }
+        if(overlapped_.hEvent)
+            CloseHandle(overlapped_.hEvent);
+    }
+
+    read_directory_changes_watch(const read_directory_changes_watch&) = delete;
+    read_directory_changes_watch& operator=(const read_directory_changes_watch&) = delete;
+
+    void start(std::function<void()> on_touched) override {
+        if(dir_ == INVALID_HANDLE_VALUE || !overlapped_.hEvent || !issue())
+            return;
+
+        on_touched_ = std::move(on_touched);
+        reactor_.add_handle(overlapped_.hEvent, [this]() {
+            if(consume())
+                on_touched_();
+        });
+        started_ = true;
+    }
+
+private:
+    bool issue() {
+        ResetEvent(overlapped_.hEvent);
+        pending_ = ReadDirectoryChangesW(dir_, buffer_, sizeof(buffer_), false,
+                                         FILE_NOTIFY_CHANGE_FILE_NAME | FILE_NOTIFY_CHANGE_LAST_WRITE | FILE_NOTIFY_CHANGE_SIZE,
+                                         nullptr, &overlapped_, nullptr);
+        return pending_;
+    }
+
+    // Collects the completed read and immediately queues the next one.
+    bool consume() {
+        DWORD bytes = 0;
+        if(!GetOverlappedResult(dir_, &overlapped_, &bytes, false) && GetLastError() == ERROR_IO_INCOMPLETE)
+            return false;
+
+        pending_ = false;
+        bool touched = bytes == 0 || names_file(bytes); // zero bytes means the buffer overflowed
+        issue();
+        return touched;
+    }
+
+    bool names_file(DWORD bytes) const {
+        const auto* base = reinterpret_cast<const BYTE*>(buffer_);
+        DWORD offset = 0;
+        while(offset < bytes) {
+            const auto* info = reinterpret_cast<const FILE_NOTIFY_INFORMATION*>(base + offset);
+            int length = static_cast<int>(info->FileNameLength / sizeof(WCHAR));
+            if(CompareStringOrdinal(info->FileName, length, name_.c_str(), static_cast<int>(name_.size()), true) == CSTR_EQUAL)
+                return true;
+
+            if(info->NextEntryOffset == 0)
+                break;
+            offset += info->NextEntryOffset;
+        }
+
+        return false;
+    }
+
+    win32_reactor& reactor_;
+    std::wstring name_;
+    std::function<void()> on_touched_;
+    HANDLE dir_ = INVALID_HANDLE_VALUE;
+    OVERLAPPED overlapped_ {};
+    bool pending_ = false, started_ = false;
+    alignas(DWORD) BYTE buffer_[4096];
+};
@@ -0,0 +1,110 @@
+#pragma once
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+
+struct sound_sampler_settings {
+    std::chrono::milliseconds on_delay { 0 };      // sound has to persist this long before reporting on
+    std::chrono::milliseconds off_delay { 50000 }; // silence has to persist this long before reporting off
+    std::chrono::milliseconds fast_interval { 1000 };
+    std::chrono::milliseconds slow_interval { 5000 };
+    std::chrono::milliseconds sample_interval { 100 }; // meter readings between polls, 0 to only read on polls
+
+    bool operator==(const sound_sampler_settings&) const = default;
+};
+
+// Schedules volume polls and applies on/off hysteresis to their raw results. Polls run at the fast interval
+// right after a transition and back off exponentially to the slow interval while the state is stable; while
+// a flip is pending, the next poll is scheduled to land on its hysteresis deadline.
+class sound_sampler {
+public:
+    using clock = std::chrono::steady_clock;
+    using settings = sound_sampler_settings;
+
+    struct stats {
+        uint64_t polls;
+        uint64_t transitions;
+        double polls_per_hour;
+    };
+
+    explicit sound_sampler(settings s = {}, clock::time_point now = clock::now())
+        : started_(now) {
+        set_settings(s);
+    }
+
+    void set_settings(settings s) {
+        s.fast_interval = std::max(s.fast_interval, std::chrono::milliseconds(1));
+        s.slow_interval = std::max(s.slow_interval, s.fast_interval);
+        settings_ = s;
+        interval_ = settings_.fast_interval;
+    }
+
+    // Feeds one raw poll result; returns true if the reported state flipped.
+    bool update(bool raw, clock::time_point now) {
+        polls_++;
+
+        if(raw == state_) {
+            pending_ = false;
+            interval_ = std::min(interval_ * 2, settings_.slow_interval);
+            return false;
+        }
+
+        if(!pending_) {
+            pending_ = true;
+            pending_since_ = now;
+        }
+
+        if(now - pending_since_ < delay_to(raw))
+            return false;
+
+        state_ = raw;
+        pending_ = false;
+        interval_ = settings_.fast_interval;
+        transitions_++;
+        return true;
+    }
+
+    [[nodiscard]] bool state() const { return state_; }
+    [[nodiscard]] bool pending() const { return pending_; }
+
+    [[nodiscard]] const settings& get_settings() const { return settings_; }
+
+    // Rows of meter readings needed for a poll to see everything since the previous one, even across a pending flip.
+    [[nodiscard]] size_t window_depth() const {
+        if(settings_.sample_interval.count() <= 0)
+            return 1;
+
+        auto span = std::max({ settings_.slow_interval, settings_.on_delay, settings_.off_delay });
+        return std::min<size_t>(static_cast<size_t>(span / settings_.sample_interval) + 2, max_window_depth_);
+    }
+
+    [[nodiscard]] std::chrono::milliseconds next_interval(clock::time_point now) const {
+        if(!pending_)
+            return interval_;
+
+        auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(pending_since_ + delay_to(!state_) - now);
+        return std::max(remaining, settings_.fast_interval);
+    }
+
+    [[nodiscard]] stats get_stats(clock::time_point now = clock::now()) const {
+        double hours = std::chrono::duration<double, std::ratio<3600>>(now - started_).count();
+        return { polls_, transitions_, hours > 0 ? polls_ / hours : 0.0 };
+    }
+
+private:
+    static constexpr size_t max_window_depth_ = 4096;
+
+    std::chrono::milliseconds delay_to(bool target) const {
+        return target ? settings_.on_delay : settings_.off_delay;
+    }
+
+    settings settings_;
+    std::chrono::milliseconds interval_ {};
+
+    bool state_ = false;
+    bool pending_ = false;
+    clock::time_point pending_since_ {};
+
+    clock::time_point started_;
+    uint64_t polls_ = 0, transitions_ = 0;
+};
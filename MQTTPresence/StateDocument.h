@@ -0,0 +1,46 @@
+#pragma once
+#include <array>
+#include <cstring>
+#include <string_view>
+
+// Writes a flat JSON object of ON/OFF fields, e.g. {"user":"ON","sound":"OFF"}, into a buffer it owns and reuses,
+// so serializing never allocates. Keys are written as given and have to be plain identifiers.
+class state_document {
+public:
+    static constexpr size_t capacity = 256;
+
+    void begin() {
+        size_ = 0;
+        overflowed_ = false;
+        put("{");
+    }
+
+    void add(std::string_view key, bool value) {
+        if(size_ > 1)
+            put(",");
+        put("\"");
+        put(key);
+        put(value ? "\":\"ON\"" : "\":\"OFF\"");
+    }
+
+    // The document, valid until the next begin(); empty if it did not fit
+    [[nodiscard]] std::string_view end() {
+        put("}");
+        return overflowed_ ? std::string_view() : std::string_view(buffer_.data(), size_);
+    }
+
+private:
+    void put(std::string_view s) {
+        if(overflowed_ || s.size() > capacity - size_) {
+            overflowed_ = true;
+            return;
+        }
+
+        std::memcpy(buffer_.data() + size_, s.data(), s.size());
+        size_ += s.size();
+    }
+
+    std::array<char, capacity> buffer_;
+    size_t size_ = 0;
+    bool overflowed_ = false;
+};
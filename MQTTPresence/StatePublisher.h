@@ -0,0 +1,106 @@
+#pragma once
+#include <cstddef>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "PublishPolicy.h"
+#include "PublishQueue.h"
+#include "StateDocument.h"
+
+// The ON/OFF states of a fixed set of sensors, and every message they can go out as. Topics and payloads never
+// change, so they are built once and publishing a state only copies a shared pointer into the publish queue.
+//
+// In consolidated mode every state goes out as one document on a single topic. There is one interned document
+// per combination of states, indexed by a bit mask of them, so a change is still only a lookup.
+class state_publisher {
+public:
+    using message_factory = std::function<mqtt::message_ptr(const std::string& topic, const std::string& payload, message_class cls)>;
+
+    // Up to 8 sensors, named by plain identifiers, each published on <base_topic>/<name>/state or as a field of
+    // the document on <base_topic>/state
+    state_publisher(const std::string& base_topic, const std::vector<const char*>& names, bool consolidated, const message_factory& make)
+        : consolidated_(consolidated), document_topic_(base_topic + "/state") {
+        for(const char* name : names) {
+            auto& s = states_.emplace_back();
+            s.name = name;
+            s.topic = base_topic + "/" + name + "/state";
+            s.on = make(s.topic, "ON", message_class::STATE);
+            s.off = make(s.topic, "OFF", message_class::STATE);
+            s.refresh_on = make(s.topic, "ON", message_class::HEARTBEAT);
+            s.refresh_off = make(s.topic, "OFF", message_class::HEARTBEAT);
+        }
+
+        if(!consolidated_)
+            return;
+
+        state_document doc;
+        for(size_t mask = 0; mask < (size_t(1) << states_.size()); mask++) {
+            doc.begin();
+            for(size_t i = 0; i < states_.size(); i++)
+                doc.add(states_[i].name, (mask >> i) & 1);
+            std::string payload(doc.end());
+            documents_.push_back(make(document_topic_, payload, message_class::STATE));
+            refresh_documents_.push_back(make(document_topic_, payload, message_class::HEARTBEAT));
+        }
+    }
+
+    state_publisher(const state_publisher&) = delete;
+    state_publisher& operator=(const state_publisher&) = delete;
+
+    // Reserves the state topics' slots in a new queue, before anything is published into it
+    void register_topics(publish_queue& queue) {
+        if(consolidated_)
+            document_slot_ = queue.register_topic(document_topic_);
+        else {
+            for(auto& s : states_)
+                s.slot = queue.register_topic(s.topic);
+        }
+    }
+
+    // A forced publish goes out as a heartbeat even if the broker already has the state. States may be published
+    // from several threads: in consolidated mode the mask is updated and its document queued under one lock, so a
+    // document built from an older mask never lands after a newer one.
+    void publish(publish_queue& queue, size_t sensor, bool state, bool force = false) {
+        const auto& s = states_[sensor];
+
+        if(consolidated_) {
+            unsigned bit = 1u << sensor;
+            std::lock_guard lock(document_mutex_);
+            document_mask_ = state ? document_mask_ | bit : document_mask_ & ~bit;
+            if(force)
+                queue.enqueue(document_slot_, refresh_documents_[document_mask_], true);
+            else
+                queue.enqueue(document_slot_, documents_[document_mask_]);
+            return;
+        }
+
+        if(force)
+            queue.enqueue(s.slot, state ? s.refresh_on : s.refresh_off, true);
+        else
+            queue.enqueue(s.slot, state ? s.on : s.off);
+    }
+
+    [[nodiscard]] size_t size() const { return states_.size(); }
+    [[nodiscard]] const char* name(size_t sensor) const { return states_[sensor].name; }
+    [[nodiscard]] bool consolidated() const { return consolidated_; }
+    [[nodiscard]] const std::string& document_topic() const { return document_topic_; }
+
+private:
+    struct interned_state {
+        const char* name;
+        std::string topic;
+        size_t slot = publish_queue::npos;
+        mqtt::const_message_ptr on, off, refresh_on, refresh_off;
+    };
+
+    const bool consolidated_;
+    std::vector<interned_state> states_;
+
+    std::string document_topic_;
+    size_t document_slot_ = publish_queue::npos;
+    std::vector<mqtt::const_message_ptr> documents_, refresh_documents_;
+    std::mutex document_mutex_;
+    unsigned document_mask_ = 0;
+};
@@ -0,0 +1,48 @@
+#pragma once
+#include <algorithm>
+#include <chrono>
+#include <vector>
+
+// Times the phases of a shutdown or restart, which all share one deadline. Phases running on other threads
+// measure themselves and are recorded once joined.
+class teardown_timer {
+public:
+    using clock = std::chrono::steady_clock;
+
+    struct phase {
+        const char* name;
+        std::chrono::microseconds elapsed;
+    };
+
+    explicit teardown_timer(clock::duration budget)
+        : start_(clock::now()), deadline_(start_ + budget), last_(start_) {}
+
+    [[nodiscard]] clock::time_point deadline() const { return deadline_; }
+
+    [[nodiscard]] clock::duration remaining() const {
+        return std::max(deadline_ - clock::now(), clock::duration::zero());
+    }
+
+    // Ends a sequential phase, which started where the previous one ended
+    void mark(const char* name) {
+        auto now = clock::now();
+        phases_.push_back({ name, std::chrono::duration_cast<std::chrono::microseconds>(now - last_) });
+        last_ = now;
+    }
+
+    void record(const char* name, std::chrono::microseconds elapsed) {
+        phases_.push_back({ name, elapsed });
+    }
+
+    [[nodiscard]] std::chrono::microseconds total() const {
+        return std::chrono::duration_cast<std::chrono::microseconds>(clock::now() - start_);
+    }
+
+    [[nodiscard]] bool overran() const { return clock::now() > deadline_; }
+
+    [[nodiscard]] const std::vector<phase>& phases() const { return phases_; }
+
+private:
+    clock::time_point start_, deadline_, last_;
+    std::vector<phase> phases_;
+};
@@ -0,0 +1,63 @@
+#pragma once
+#include <windows.h>
+#include <TlHelp32.h>
+#include <string>
+#include <vector>
+
+#include "ProcessInventory.h"
+
+// Process snapshots from the Toolhelp API, which reports PID, parent PID and image name without opening
+// any process and without a fixed upper bound on the process count.
+class toolhelp_process_inventory : public process_inventory {
+public:
+    bool snapshot(std::vector<process_entry>& out) override {
+        HANDLE snap = CreateToolhelp32Snapshot(TH32CS_SNAPPROCESS, 0);
+        if(snap == INVALID_HANDLE_VALUE)
+            return false;
+
+        size_t count = 0;
+        PROCESSENTRY32W pe { sizeof(PROCESSENTRY32W) };
+        for(BOOL ok = Process32FirstW(snap, &pe); ok; ok = Process32NextW(snap, &pe)) {
+            if(count == out.size())
+                out.emplace_back();
+
+            auto& e = out[count++];
+            e.pid = pe.th32ProcessID;
+            e.parent_pid = pe.th32ParentProcessID;
+            e.name.assign(pe.szExeFile);
+        }
+        out.resize(count);
+
+        CloseHandle(snap);
+        return true;
+    }
+
+    bool process_path(uint32_t pid, std::wstring& out) override {
+        HANDLE proc = OpenProcess(PROCESS_QUERY_LIMITED_INFORMATION, false, pid);
+        if(!proc)
+            return false;
+
+        wchar_t proc_path[MAX_PATH];
+        DWORD proc_path_size = MAX_PATH;
+        bool found = QueryFullProcessImageNameW(proc, 0, proc_path, &proc_path_size);
+        if(found)
+            out.assign(proc_path, proc_path_size);
+        CloseHandle(proc);
+
+        return found;
+    }
+
+    bool process_start_time(uint32_t pid, uint64_t& out) override {
+        HANDLE proc = OpenProcess(PROCESS_QUERY_LIMITED_INFORMATION, false, pid);
+        if(!proc)
+            return false;
+
+        FILETIME creation, exit, kernel, user;
+        bool found = GetProcessTimes(proc, &creation, &exit, &kernel, &user);
+        if(found)
+            out = static_cast<uint64_t>(creation.dwHighDateTime) << 32 | creation.dwLowDateTime;
+        CloseHandle(proc);
+
+        return found;
+    }
+};
@@ -0,0 +1,124 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <vector>
+
+// Timestamped sensor transitions kept as fixed-size records in a ring over caller-provided memory, normally a
+// mapped file so the journal survives restarts. Records past the acknowledged mark are the ones the broker has
+// not confirmed yet; once the ring is full the oldest of them are overwritten and counted as lost.
+//
+// There is a single writer, whose append() is a record store followed by a release store of the head, so it
+// can sit on the hot path. Readers may run on any one other thread.
+class transition_journal {
+public:
+    struct record {
+        int64_t time; // milliseconds since the Unix epoch
+        uint32_t seq; // low bits of the sequence number
+        uint8_t sensor;
+        uint8_t value;
+        uint8_t present;
+        uint8_t reserved;
+    };
+
+    struct batch {
+        uint64_t first;
+        uint64_t next; // acknowledge this once the batch was delivered
+        std::vector<record> records;
+    };
+
+    struct stats {
+        uint64_t appended;
+        uint64_t acknowledged;
+        uint64_t pending;
+        uint64_t lost;
+    };
+
+    static size_t bytes_for(uint32_t capacity) {
+        return sizeof(header) + sizeof(record) * capacity;
+    }
+
+    // Picks up the journal already in memory if it has the same shape, otherwise starts an empty one
+    transition_journal(void* memory, uint32_t capacity)
+        : header_(static_cast<header*>(memory))
+        , records_(reinterpret_cast<record*>(static_cast<header*>(memory) + 1))
+        , capacity_(capacity) {
+        if(header_->magic != magic || header_->version != version || header_->capacity != capacity ||
+           header_->record_size != sizeof(record) || header_->acked.load() > header_->head.load()) {
+            header_ = new (memory) header { magic, version, capacity, sizeof(record) };
+        }
+    }
+
+    transition_journal(const transition_journal&) = delete;
+    transition_journal& operator=(const transition_journal&) = delete;
+
+    // Writer thread only
+    void append(int64_t time, uint8_t sensor, bool value, bool present) {
+        uint64_t seq = header_->head.load(std::memory_order_relaxed);
+        records_[seq % capacity_] = { time, static_cast<uint32_t>(seq), sensor, value, present, 0 };
+        header_->head.store(seq + 1, std::memory_order_release);
+    }
+
+    // Copies up to max records from the oldest unacknowledged one on. Records the writer overwrote while
+    // they were being copied are left out.
+    [[nodiscard]] batch read(size_t max) const {
+        uint64_t head = header_->head.load(std::memory_order_acquire);
+        uint64_t first = std::max(header_->acked.load(std::memory_order_acquire), oldest(head));
+
+        batch b { first, first, {} };
+        b.records.reserve(static_cast<size_t>(std::min<uint64_t>(head - first, max)));
+        for(uint64_t seq = first; seq < head && b.records.size() < max; seq++)
+            b.records.push_back(records_[seq % capacity_]);
+
+        // Anything the writer may have lapped since head was loaded is dropped from the front
+        std::atomic_thread_fence(std::memory_order_acquire);
+        uint64_t valid_from = oldest(header_->head.load(std::memory_order_relaxed));
+        if(valid_from > first) {
+            size_t stale = static_cast<size_t>(std::min<uint64_t>(valid_from - first, b.records.size()));
+            b.records.erase(b.records.begin(), b.records.begin() + stale);
+            b.first += stale;
+        }
+        b.next = b.first + b.records.size();
+        return b;
+    }
+
+    void acknowledge(uint64_t next) {
+        uint64_t acked = header_->acked.load(std::memory_order_relaxed);
+        while(next > acked && !header_->acked.compare_exchange_weak(acked, next, std::memory_order_release))
+            ;
+    }
+
+    [[nodiscard]] stats get_stats() const {
+        uint64_t head = header_->head.load(std::memory_order_acquire);
+        uint64_t acked = header_->acked.load(std::memory_order_acquire);
+        uint64_t first = std::max(acked, oldest(head));
+        return { head, acked, head - first, first - acked };
+    }
+
+private:
+    static constexpr uint32_t magic = 0x4e52544d; // "MTRN"
+    static constexpr uint32_t version = 1;
+
+    struct header {
+        uint32_t magic;
+        uint32_t version;
+        uint32_t capacity;
+        uint32_t record_size;
+        std::atomic<uint64_t> head { 0 };  // sequence number of the next record
+        std::atomic<uint64_t> acked { 0 }; // records before this one were delivered
+    };
+
+    static_assert(std::atomic<uint64_t>::is_always_lock_free, "the journal header is shared through memory");
+    static_assert(sizeof(record) == 16);
+
+    // One slot is kept back for the record the writer may be storing right now
+    [[nodiscard]] uint64_t oldest(uint64_t head) const {
+        return head >= capacity_ ? head - capacity_ + 1 : 0;
+    }
+
+    header* header_;
+    record* records_;
+    uint32_t capacity_;
+};
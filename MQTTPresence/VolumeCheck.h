@@ -1,105 +1,202 @@
 #pragma once
-#include <wrl/client.h>
-#include <mmdeviceapi.h>
+#include <algorithm>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
 #include <vector>
-#include <audiopolicy.h>
 #include <string>
-#include <endpointvolume.h>
-#include <unordered_set>
 
+#include "AudioSource.h"
+#include "LevelWindow.h"
+#include "ProcessMatcher.h"
+#include "ProcessNameCache.h"
+
+// Decides sound presence from a window of meter readings rather than a single one: sample() records every
+// session's peak into a level_window at a high rate, and poll() looks at everything recorded since the last poll,
+// so short sounds between polls are caught and brief pauses do not read as silence.
 class volume_check {
 public:
+    struct levels {
+        float max;
+        float rms;
+    };
+
     volume_check() = default;
 
-    explicit volume_check(bool check_all_devices) {
-        using namespace Microsoft::WRL;
+    explicit volume_check(std::unique_ptr<audio_source> source, size_t window_depth = 1)
+        : source_(std::move(source)) {
+        window_.reset(0, window_depth);
+    }
+
+    // An empty matcher accepts sound from any process. May be swapped while another thread polls.
+    void set_process_matcher(process_matcher matcher) {
+        std::lock_guard lock(matcher_mutex_);
+        matcher_ = std::move(matcher);
+    }
+
+    // Drops the recorded history.
+    void set_window_depth(size_t depth) {
+        window_.reset(window_.columns(), depth);
+        rows_since_poll_ = 0;
+    }
+
+    // True while no session can be producing sound; the meters need not be read until the source wakes us.
+    [[nodiscard]] bool idle() const {
+        return !source_ || source_->idle();
+    }
 
-        ComPtr<IMMDeviceEnumerator> device_enumerator;
-        if(FAILED(CoCreateInstance(__uuidof(MMDeviceEnumerator), nullptr, CLSCTX_ALL, IID_PPV_ARGS(device_enumerator.GetAddressOf()))))
+    void set_wake_handler(std::function<void()> handler) {
+        if(source_)
+            source_->set_wake_handler(std::move(handler));
+    }
+
+    // Reads every session's meter once; cheap enough to be called several times per second.
+    void sample() {
+        if(!source_)
             return;
 
-        if(check_all_devices) {
-            ComPtr<IMMDeviceCollection> devices;
-            device_enumerator->EnumAudioEndpoints(eRender, DEVICE_STATE_ACTIVE, devices.GetAddressOf());
-            unsigned int device_count;
-            devices->GetCount(&device_count);
-            for(unsigned int dev_id = 0; dev_id < device_count; dev_id++) {
-                auto& dev = devices_.emplace_back();
-                devices->Item(dev_id, dev.GetAddressOf());
-            }
-        } else {
-            auto& dev = devices_.emplace_back();
-            device_enumerator->GetDefaultAudioEndpoint(eRender, eMultimedia, dev.GetAddressOf());
+        source_->sample(samples_);
+        tick_++;
+
+        sample_slots_.resize(samples_.size());
+        for(size_t i = 0; i < samples_.size(); i++)
+            sample_slots_[i] = slot_for({ samples_[i].pid, samples_[i].start_time });
+
+        // A process can own several sessions; its column holds the loudest
+        float* row = window_.next_row();
+        for(size_t i = 0; i < samples_.size(); i++) {
+            size_t s = sample_slots_[i];
+            row[s] = std::max(row[s], samples_[i].peak);
         }
+
+        rows_since_poll_++;
     }
 
-    void add_process_name(const std::wstring& name) {
-        proc_names_.insert(name);
+    // Sessions seen by the last meter reading
+    [[nodiscard]] size_t sessions() const {
+        return samples_.size();
     }
 
-    [[nodiscard]] bool poll() const {
-        for(const auto& device : devices_)
-            if(poll_device(device))
-                return true;
+    [[nodiscard]] bool poll() {
+        if(!source_)
+            return false;
 
-        return false;
-    }
+        // Without high-rate sampling, decide from a single reading
+        if(rows_since_poll_ == 0)
+            sample();
 
-private:
-    [[nodiscard]] bool poll_device(const Microsoft::WRL::ComPtr<IMMDevice>& device) const {
-        using namespace Microsoft::WRL;
-
-        ComPtr<IAudioSessionManager2> session_manager;
-        device->Activate(__uuidof(IAudioSessionManager2), CLSCTX_ALL, nullptr,
-                      reinterpret_cast<void**>(session_manager.GetAddressOf()));
-        ComPtr<IAudioSessionEnumerator> enumerator;
-        session_manager->GetSessionEnumerator(enumerator.GetAddressOf());
-
-        int session_count;
-        enumerator->GetCount(&session_count);
-        for (int session_index = 0; session_index < session_count; session_index++) {
-            ComPtr<IAudioSessionControl> session_control;
-            if (FAILED(enumerator->GetSession(session_index, session_control.GetAddressOf())))
-                continue;
-            ComPtr<IAudioSessionControl2> session_control2;
-            if (FAILED(session_control->QueryInterface(IID_PPV_ARGS(session_control2.GetAddressOf()))))
-                continue;
-            ComPtr<IAudioMeterInformation> meter_information;
-            if(FAILED(session_control->QueryInterface(IID_PPV_ARGS(meter_information.GetAddressOf()))))
+        window_.compute(rows_since_poll_, max_, rms_);
+        rows_since_poll_ = 0;
+
+        std::lock_guard lock(matcher_mutex_);
+
+        // Every live session is visited, even after a match, so the name cache can tell which processes are gone
+        bool active = false;
+        last_levels_ = {};
+        for(size_t i = 0; i < slots_.size(); i++) {
+            const auto& slot = slots_[i];
+            if(!slot.used)
                 continue;
 
-            float proc_value = 0.f;
-            meter_information->GetPeakValue(&proc_value);
-            if(proc_value < 0.00001f)
+            if(active || max_[i] < peak_threshold_) {
+                names_.touch(slot.key);
                 continue;
-            
-            std::wstring proc_name;
-            DWORD pid;
-            session_control2->GetProcessId(&pid);
-            HANDLE proc = OpenProcess(PROCESS_QUERY_LIMITED_INFORMATION, false, pid);
-            if(proc) {
-                wchar_t proc_path[MAX_PATH];
-                DWORD proc_len = MAX_PATH;
-                if(QueryFullProcessImageNameW(proc, 0, proc_path, &proc_len)) {
-                    wchar_t filename[MAX_PATH];
-                    wchar_t fileext[MAX_PATH];
-                    _wsplitpath_s(proc_path, nullptr, 0, nullptr, 0, filename, MAX_PATH, fileext, MAX_PATH);
-                    proc_name = filename;
-                    proc_name += fileext;
-                }
-                CloseHandle(proc);
             }
 
-            if(proc_name.empty())
+            const std::wstring* path = names_.find(slot.key);
+            if(!path) {
+                // Failures are cached too, so e.g. the system sounds session is not re-resolved every poll
+                if(!source_->process_path(slot.key.pid, proc_path_))
+                    proc_path_.clear();
+                path = &names_.insert(slot.key, std::move(proc_path_));
+            }
+
+            // Sessions without a resolvable process never count
+            if(path->empty())
                 continue;
 
-            if(proc_names_.empty() || proc_names_.count(proc_name) > 0)
-                return true;
+            if(matcher_.empty() || matcher_.matches_path(*path)) {
+                active = true;
+                last_levels_ = { max_[i], rms_[i] };
+            }
         }
 
-        return false;
+        names_.sweep();
+        release_stale_slots();
+
+        return active;
+    }
+
+    // Window levels of the session that made the last poll active, zero otherwise.
+    [[nodiscard]] levels last_levels() const {
+        return last_levels_;
+    }
+
+    [[nodiscard]] process_name_cache::stats name_cache_stats() const {
+        return names_.get_stats();
     }
 
-    std::vector<Microsoft::WRL::ComPtr<IMMDevice>> devices_;
-    std::unordered_set<std::wstring> proc_names_;
+private:
+    struct slot {
+        process_key key;
+        uint64_t last_tick;
+        bool used;
+    };
+
+    size_t slot_for(const process_key& key) {
+        auto it = slot_of_.find(key);
+        if(it != slot_of_.end()) {
+            slots_[it->second].last_tick = tick_;
+            return it->second;
+        }
+
+        size_t s;
+        if(!free_slots_.empty()) {
+            s = free_slots_.back();
+            free_slots_.pop_back();
+            window_.clear_column(s);
+            slots_[s] = { key, tick_, true };
+        } else {
+            s = slots_.size();
+            slots_.push_back({ key, tick_, true });
+            // Doubling keeps reshaping the window rare as sessions come and go
+            if(slots_.size() > window_.columns())
+                window_.grow(std::max<size_t>(slots_.size(), window_.columns() * 2));
+        }
+
+        slot_of_.emplace(key, s);
+        return s;
+    }
+
+    // Columns are only reused once the session has been gone for a whole window, so its sound still counts until then.
+    void release_stale_slots() {
+        for(size_t i = 0; i < slots_.size(); i++) {
+            auto& slot = slots_[i];
+            if(slot.used && slot.last_tick + window_.depth() <= tick_) {
+                slot_of_.erase(slot.key);
+                slot.used = false;
+                free_slots_.push_back(i);
+            }
+        }
+    }
+
+    static constexpr float peak_threshold_ = 0.00001f;
+
+    std::unique_ptr<audio_source> source_;
+    std::vector<audio_session_sample> samples_;
+    std::vector<size_t> sample_slots_;
+
+    level_window window_;
+    std::vector<slot> slots_;
+    std::unordered_map<process_key, size_t, process_key_hash> slot_of_;
+    std::vector<size_t> free_slots_;
+    uint64_t tick_ = 0;
+    size_t rows_since_poll_ = 0;
+    std::vector<float> max_, rms_;
+    levels last_levels_ {};
+
+    std::wstring proc_path_;
+    process_name_cache names_;
+    std::mutex matcher_mutex_;
+    process_matcher matcher_;
 };
@@ -0,0 +1,159 @@
+#pragma once
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <utility>
+
+#include "AudioSource.h"
+#include "Config.h"
+#include "Metrics.h"
+#include "ProcessMatcher.h"
+#include "Reactor.h"
+#include "SoundSampler.h"
+#include "VolumeCheck.h"
+
+// Drives the volume check from reactor timers, so it can be rebuilt when its settings change. Meters are read every
+// sample interval while a session could be playing; once none can and the state has settled, nothing is scheduled
+// until the audio source reports a session becoming active.
+class volume_worker {
+public:
+    // Builds the platform's audio source for a configuration
+    using source_factory = std::function<std::unique_ptr<audio_source>(const config&)>;
+
+    volume_worker(reactor& reactor, source_factory make_source, std::function<void(bool)> on_change)
+        : reactor_(reactor), make_source_(std::move(make_source)), on_change_(std::move(on_change)) {}
+
+    ~volume_worker() {
+        stop();
+    }
+
+    volume_worker(const volume_worker&) = delete;
+    volume_worker& operator=(const volume_worker&) = delete;
+
+    // Receives the duration of every poll and the number of sessions every meter reading visited; set before start.
+    void set_metrics(metrics_registry::histogram* poll_time, metrics_registry::counter* sessions_scanned) {
+        poll_time_ = poll_time;
+        sessions_scanned_ = sessions_scanned;
+    }
+
+    void start(const config& cfg) {
+        stop();
+
+        sampler_ = sound_sampler(cfg.sound_sampling);
+        check_ = std::make_unique<volume_check>(make_source_(cfg), sampler_.window_depth());
+        check_->set_process_matcher(cfg.volume_matcher);
+
+        // Called on the source's own threads, and possibly after this worker is gone
+        token_ = std::make_shared<int>(0);
+        check_->set_wake_handler([this, token = std::weak_ptr<int>(token_)]() {
+            reactor_.post([this, token]() {
+                if(token.lock())
+                    wake();
+            });
+        });
+
+        auto now = sound_sampler::clock::now();
+        next_poll_ = now + sampler_.next_interval(now);
+        parked_ = false;
+        schedule(now);
+    }
+
+    void stop() {
+        if(timer_) {
+            reactor_.cancel_timer(timer_);
+            timer_ = 0;
+        }
+        token_.reset();
+        check_.reset();
+    }
+
+    void set_process_matcher(const process_matcher& matcher) {
+        if(check_)
+            check_->set_process_matcher(matcher);
+    }
+
+    void set_sampler_settings(const sound_sampler_settings& settings) {
+        sampler_.set_settings(settings);
+        if(!check_)
+            return;
+
+        check_->set_window_depth(sampler_.window_depth());
+        auto now = sound_sampler::clock::now();
+        next_poll_ = now + sampler_.next_interval(now);
+        if(!parked_)
+            schedule(now);
+    }
+
+    [[nodiscard]] sound_sampler::stats sampler_stats() const {
+        return sampler_.get_stats();
+    }
+
+private:
+    // Wakes at the next poll, or earlier for the next meter reading if anything could be playing
+    void schedule(sound_sampler::clock::time_point now) {
+        if(timer_)
+            reactor_.cancel_timer(timer_);
+
+        auto due = next_poll_;
+        auto sample_interval = sampler_.get_settings().sample_interval;
+        if(sample_interval.count() > 0 && !check_->idle())
+            due = std::min(due, now + sample_interval);
+
+        timer_ = reactor_.add_timer(due, [this]() {
+            timer_ = 0;
+            tick();
+        });
+    }
+
+    // Polls decide from everything read since the previous poll
+    void tick() {
+        auto now = sound_sampler::clock::now();
+        bool idle = check_->idle();
+        if(!idle && sampler_.get_settings().sample_interval.count() > 0) {
+            check_->sample();
+            if(sessions_scanned_)
+                sessions_scanned_->add(check_->sessions());
+        }
+
+        if(now >= next_poll_) {
+            auto start = std::chrono::steady_clock::now();
+            bool raw = check_->poll();
+            if(poll_time_)
+                poll_time_->record_since(start);
+            if(sampler_.update(raw, now))
+                on_change_(sampler_.state());
+            next_poll_ = now + sampler_.next_interval(now);
+
+            if(idle && !sampler_.state() && !sampler_.pending()) {
+                parked_ = true;
+                return;
+            }
+        }
+
+        schedule(now);
+    }
+
+    void wake() {
+        if(!parked_ || !check_)
+            return;
+
+        parked_ = false;
+        auto now = sound_sampler::clock::now();
+        next_poll_ = now + sampler_.get_settings().fast_interval;
+        schedule(now);
+    }
+
+    reactor& reactor_;
+    source_factory make_source_;
+    std::function<void(bool)> on_change_;
+    metrics_registry::histogram* poll_time_ = nullptr;
+    metrics_registry::counter* sessions_scanned_ = nullptr;
+
+    std::unique_ptr<volume_check> check_;
+    sound_sampler sampler_;
+    std::shared_ptr<int> token_;
+    reactor::timer_id timer_ = 0;
+    sound_sampler::clock::time_point next_poll_;
+    bool parked_ = false;
+};
@@ -0,0 +1,380 @@
+#pragma once
+#include <wrl/client.h>
+#include <wrl/implements.h>
+#include <mmdeviceapi.h>
+#include <audiopolicy.h>
+#include <endpointvolume.h>
+#include <algorithm>
+#include <atomic>
+#include <format>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "AudioSource.h"
+
+// Keeps a persistent table of audio sessions per render endpoint. The table is seeded once and then
+// maintained from IAudioSessionNotification/IAudioSessionEvents, so sample() only reads meters. The set of
+// endpoints follows IMMNotificationClient: devices that stay keep their session manager and sessions, and
+// only the ones that came or went are added or dropped on the next sample.
+class wasapi_audio_source : public audio_source {
+public:
+    explicit wasapi_audio_source(bool check_all_devices) : check_all_devices_(check_all_devices) {
+        using namespace Microsoft::WRL;
+
+        if(FAILED(CoCreateInstance(__uuidof(MMDeviceEnumerator), nullptr, CLSCTX_ALL, IID_PPV_ARGS(enumerator_.GetAddressOf()))))
+            return;
+
+        // Registered before the first enumeration, so no change can fall between the two
+        device_notification_ = Make<device_notification>(this);
+        if(FAILED(enumerator_->RegisterEndpointNotificationCallback(device_notification_.Get())))
+            device_notification_.Reset();
+
+        refresh_devices();
+    }
+
+    ~wasapi_audio_source() override {
+        // Unregistering blocks until in-flight callbacks return, after which nothing can reach us
+        if(device_notification_)
+            enumerator_->UnregisterEndpointNotificationCallback(device_notification_.Get());
+        for(auto& dev : devices_)
+            dev.manager->UnregisterSessionNotification(dev.notification.Get());
+        for(auto& s : sessions_)
+            s.control->UnregisterAudioSessionNotification(s.events.Get());
+    }
+
+    wasapi_audio_source(const wasapi_audio_source&) = delete;
+    wasapi_audio_source& operator=(const wasapi_audio_source&) = delete;
+
+    void sample(std::vector<audio_session_sample>& out) override {
+        if(devices_changed_.exchange(false))
+            refresh_devices();
+        adopt_pending();
+
+        out.clear();
+        for(size_t i = 0; i < sessions_.size();) {
+            auto& s = sessions_[i];
+            auto state = s.events->state();
+            if(state == AudioSessionStateExpired) {
+                s.control->UnregisterAudioSessionNotification(s.events.Get());
+                s = std::move(sessions_.back());
+                sessions_.pop_back();
+                continue;
+            }
+
+            float peak = 0.f;
+            if(state == AudioSessionStateActive)
+                s.meter->GetPeakValue(&peak);
+            out.push_back({ s.pid, s.start_time, peak });
+            i++;
+        }
+    }
+
+    bool idle() override {
+        if(devices_changed_)
+            return false;
+
+        {
+            std::lock_guard lock(pending_mutex_);
+            if(!pending_.empty())
+                return false;
+        }
+
+        for(const auto& s : sessions_)
+            if(s.events->state() == AudioSessionStateActive)
+                return false;
+
+        return true;
+    }
+
+    void set_wake_handler(std::function<void()> handler) override {
+        std::lock_guard lock(wake_mutex_);
+        wake_ = std::move(handler);
+    }
+
+    bool process_path(uint32_t pid, std::wstring& out) override {
+        HANDLE proc = OpenProcess(PROCESS_QUERY_LIMITED_INFORMATION, false, pid);
+        if(!proc)
+            return false;
+
+        bool found = false;
+        wchar_t proc_path[MAX_PATH];
+        DWORD proc_len = MAX_PATH;
+        if(QueryFullProcessImageNameW(proc, 0, proc_path, &proc_len)) {
+            out.assign(proc_path, proc_len);
+            found = !out.empty();
+        }
+        CloseHandle(proc);
+
+        return found;
+    }
+
+private:
+    class session_events : public Microsoft::WRL::RuntimeClass<Microsoft::WRL::RuntimeClassFlags<Microsoft::WRL::ClassicCom>, IAudioSessionEvents> {
+    public:
+        session_events(wasapi_audio_source* owner, AudioSessionState initial) : owner_(owner), state_(initial) {}
+
+        AudioSessionState state() const { return state_; }
+
+        STDMETHODIMP OnStateChanged(AudioSessionState new_state) override {
+            state_ = new_state;
+            if(new_state == AudioSessionStateActive)
+                owner_->wake();
+            return S_OK;
+        }
+
+        STDMETHODIMP OnSessionDisconnected(AudioSessionDisconnectReason) override {
+            state_ = AudioSessionStateExpired;
+            return S_OK;
+        }
+
+        STDMETHODIMP OnDisplayNameChanged(LPCWSTR, LPCGUID) override { return S_OK; }
+        STDMETHODIMP OnIconPathChanged(LPCWSTR, LPCGUID) override { return S_OK; }
+        STDMETHODIMP OnSimpleVolumeChanged(float, BOOL, LPCGUID) override { return S_OK; }
+        STDMETHODIMP OnChannelVolumeChanged(DWORD, float[], DWORD, LPCGUID) override { return S_OK; }
+        STDMETHODIMP OnGroupingParamChanged(LPCGUID, LPCGUID) override { return S_OK; }
+
+    private:
+        wasapi_audio_source* owner_;
+        std::atomic<AudioSessionState> state_;
+    };
+
+    // Session creation callbacks only stash the new session; it is adopted on the polling thread,
+    // since the audio engine disallows (un)registering notifications from inside its callbacks.
+    class session_notification : public Microsoft::WRL::RuntimeClass<Microsoft::WRL::RuntimeClassFlags<Microsoft::WRL::ClassicCom>, IAudioSessionNotification> {
+    public:
+        session_notification(wasapi_audio_source* owner, uint32_t device) : owner_(owner), device_(device) {}
+
+        STDMETHODIMP OnSessionCreated(IAudioSessionControl* session) override {
+            {
+                std::lock_guard lock(owner_->pending_mutex_);
+                owner_->pending_.push_back({ device_, session });
+            }
+            owner_->wake();
+            return S_OK;
+        }
+
+    private:
+        wasapi_audio_source* owner_;
+        uint32_t device_;
+    };
+
+    // Endpoint callbacks must not call back into the device API, so they only flag the table as stale
+    class device_notification : public Microsoft::WRL::RuntimeClass<Microsoft::WRL::RuntimeClassFlags<Microsoft::WRL::ClassicCom>, IMMNotificationClient> {
+    public:
+        explicit device_notification(wasapi_audio_source* owner) : owner_(owner) {}
+
+        STDMETHODIMP OnDeviceStateChanged(LPCWSTR, DWORD) override { return changed(); }
+        STDMETHODIMP OnDeviceAdded(LPCWSTR) override { return changed(); }
+        STDMETHODIMP OnDeviceRemoved(LPCWSTR) override { return changed(); }
+
+        STDMETHODIMP OnDefaultDeviceChanged(EDataFlow flow, ERole role, LPCWSTR) override {
+            if(flow == eRender && role == eMultimedia && !owner_->check_all_devices_)
+                return changed();
+            return S_OK;
+        }
+
+        STDMETHODIMP OnPropertyValueChanged(LPCWSTR, const PROPERTYKEY) override { return S_OK; }
+
+    private:
+        HRESULT changed() {
+            owner_->devices_changed_ = true;
+            owner_->wake();
+            return S_OK;
+        }
+
+        wasapi_audio_source* owner_;
+    };
+
+    struct device_entry {
+        std::wstring id;
+        uint32_t serial; // tags the device's sessions, as ids are long and can come back after a removal
+        Microsoft::WRL::ComPtr<IMMDevice> device;
+        Microsoft::WRL::ComPtr<IAudioSessionManager2> manager;
+        Microsoft::WRL::ComPtr<session_notification> notification;
+    };
+
+    struct session_entry {
+        Microsoft::WRL::ComPtr<IAudioSessionControl2> control;
+        Microsoft::WRL::ComPtr<IAudioMeterInformation> meter;
+        Microsoft::WRL::ComPtr<session_events> events;
+        DWORD pid;
+        uint32_t device;
+        uint64_t start_time = 0;
+    };
+
+    struct pending_session {
+        uint32_t device;
+        Microsoft::WRL::ComPtr<IAudioSessionControl> control;
+    };
+
+    static std::wstring device_id(IMMDevice* device) {
+        std::wstring id;
+        LPWSTR raw = nullptr;
+        if(SUCCEEDED(device->GetId(&raw))) {
+            id = raw;
+            CoTaskMemFree(raw);
+        }
+        return id;
+    }
+
+    // Brings the device table in line with the endpoints that should be checked right now: the default one, or
+    // every active one
+    void refresh_devices() {
+        using namespace Microsoft::WRL;
+
+        if(!enumerator_)
+            return;
+
+        std::vector<ComPtr<IMMDevice>> wanted;
+        if(check_all_devices_) {
+            ComPtr<IMMDeviceCollection> devices;
+            if(FAILED(enumerator_->EnumAudioEndpoints(eRender, DEVICE_STATE_ACTIVE, devices.GetAddressOf())))
+                return;
+            unsigned int device_count;
+            devices->GetCount(&device_count);
+            for(unsigned int dev_id = 0; dev_id < device_count; dev_id++) {
+                ComPtr<IMMDevice> dev;
+                if(SUCCEEDED(devices->Item(dev_id, dev.GetAddressOf())))
+                    wanted.push_back(std::move(dev));
+            }
+        } else {
+            ComPtr<IMMDevice> dev;
+            if(SUCCEEDED(enumerator_->GetDefaultAudioEndpoint(eRender, eMultimedia, dev.GetAddressOf())))
+                wanted.push_back(std::move(dev));
+        }
+
+        std::vector<std::wstring> ids;
+        for(const auto& dev : wanted)
+            ids.push_back(device_id(dev.Get()));
+
+        for(size_t i = 0; i < devices_.size();) {
+            if(std::find(ids.begin(), ids.end(), devices_[i].id) == ids.end())
+                remove_device(i);
+            else
+                i++;
+        }
+
+        for(size_t i = 0; i < wanted.size(); i++) {
+            auto known = std::find_if(devices_.begin(), devices_.end(), [&](const device_entry& d) { return d.id == ids[i]; });
+            if(known == devices_.end())
+                add_device(wanted[i], std::move(ids[i]));
+        }
+
+#ifdef _DEBUG
+        OutputDebugStringA(std::format("Checking {} audio device(s), {} session(s)\n", devices_.size(), sessions_.size()).c_str());
+#endif
+    }
+
+    void add_device(const Microsoft::WRL::ComPtr<IMMDevice>& device, std::wstring id) {
+        using namespace Microsoft::WRL;
+
+        device_entry dev { std::move(id), next_serial_++, device };
+        if(FAILED(device->Activate(__uuidof(IAudioSessionManager2), CLSCTX_ALL, nullptr,
+                                   reinterpret_cast<void**>(dev.manager.GetAddressOf()))))
+            return;
+
+        dev.notification = Make<session_notification>(this, dev.serial);
+        if(FAILED(dev.manager->RegisterSessionNotification(dev.notification.Get())))
+            return;
+
+        // Enumerating once both seeds the table and is required for creation notifications to start
+        ComPtr<IAudioSessionEnumerator> enumerator;
+        if(SUCCEEDED(dev.manager->GetSessionEnumerator(enumerator.GetAddressOf()))) {
+            int session_count = 0;
+            enumerator->GetCount(&session_count);
+            for(int session_index = 0; session_index < session_count; session_index++) {
+                ComPtr<IAudioSessionControl> session_control;
+                if(SUCCEEDED(enumerator->GetSession(session_index, session_control.GetAddressOf())))
+                    add_session(session_control, dev.serial);
+            }
+        }
+
+        devices_.push_back(std::move(dev));
+    }
+
+    // Drops a device along with its sessions, which may well still be active on it
+    void remove_device(size_t index) {
+        auto& dev = devices_[index];
+        dev.manager->UnregisterSessionNotification(dev.notification.Get());
+        std::erase_if(sessions_, [&dev](const session_entry& s) {
+            if(s.device != dev.serial)
+                return false;
+
+            s.control->UnregisterAudioSessionNotification(s.events.Get());
+            return true;
+        });
+
+        devices_.erase(devices_.begin() + index);
+    }
+
+    void add_session(const Microsoft::WRL::ComPtr<IAudioSessionControl>& session_control, uint32_t device) {
+        using namespace Microsoft::WRL;
+
+        session_entry s;
+        s.device = device;
+        if(FAILED(session_control.As(&s.control)))
+            return;
+        if(FAILED(session_control.As(&s.meter)))
+            return;
+        if(FAILED(s.control->GetProcessId(&s.pid)))
+            return;
+
+        // Sessions are bound to one process for their lifetime, so its identity only has to be read once
+        HANDLE proc = OpenProcess(PROCESS_QUERY_LIMITED_INFORMATION, false, s.pid);
+        if(proc) {
+            FILETIME creation, exit, kernel, user;
+            if(GetProcessTimes(proc, &creation, &exit, &kernel, &user))
+                s.start_time = static_cast<uint64_t>(creation.dwHighDateTime) << 32 | creation.dwLowDateTime;
+            CloseHandle(proc);
+        }
+
+        AudioSessionState state = AudioSessionStateInactive;
+        s.control->GetState(&state);
+        if(state == AudioSessionStateExpired)
+            return;
+
+        s.events = Make<session_events>(this, state);
+        if(FAILED(s.control->RegisterAudioSessionNotification(s.events.Get())))
+            return;
+
+        sessions_.push_back(std::move(s));
+    }
+
+    void adopt_pending() {
+        {
+            std::lock_guard lock(pending_mutex_);
+            if(pending_.empty())
+                return;
+            adopting_.swap(pending_);
+        }
+
+        // Sessions of a device dropped since they were created are not adopted
+        for(const auto& p : adopting_)
+            if(std::any_of(devices_.begin(), devices_.end(), [&p](const device_entry& d) { return d.serial == p.device; }))
+                add_session(p.control, p.device);
+        adopting_.clear();
+    }
+
+    void wake() {
+        std::lock_guard lock(wake_mutex_);
+        if(wake_)
+            wake_();
+    }
+
+    bool check_all_devices_;
+    Microsoft::WRL::ComPtr<IMMDeviceEnumerator> enumerator_;
+    Microsoft::WRL::ComPtr<device_notification> device_notification_;
+    std::atomic<bool> devices_changed_ = false;
+    uint32_t next_serial_ = 0;
+
+    std::vector<device_entry> devices_;
+    std::vector<session_entry> sessions_;
+
+    std::mutex wake_mutex_;
+    std::function<void()> wake_;
+
+    std::mutex pending_mutex_;
+    std::vector<pending_session> pending_, adopting_;
+};
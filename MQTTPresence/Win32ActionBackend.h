@@ -0,0 +1,130 @@
+#pragma once
+#include <windows.h>
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <format>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "ActionEngine.h"
+#include "KillEngine.h"
+#include "ProcessSupervisor.h"
+
+// Launches through a process_supervisor and closes processes with the kill_engine, whose windows get a WM_CLOSE
+// before anything is terminated. Kills run in order on a worker thread, so the message pump never waits out a
+// grace period.
+class win32_action_backend : public action_backend {
+public:
+    explicit win32_action_backend(process_selector& selector) : supervisor_(selector) {}
+
+    // Whatever was already requested still runs, so a kill made during teardown is not lost
+    ~win32_action_backend() {
+        {
+            std::lock_guard lock(mutex_);
+            stopping_ = true;
+        }
+        wake_.notify_all();
+        if(worker_.joinable())
+            worker_.join();
+    }
+
+    win32_action_backend(const win32_action_backend&) = delete;
+    win32_action_backend& operator=(const win32_action_backend&) = delete;
+
+    void set_start_entries(const std::vector<std::pair<std::string, std::string>>& entries) override {
+        supervisor_.set_entries(entries);
+    }
+
+    void start() override {
+        supervisor_.request_launch();
+    }
+
+    // The processes are opened and their windows found right away; closing them is left to the worker
+    void kill(const std::vector<uint32_t>& pids, std::chrono::milliseconds grace) override {
+        auto start = std::chrono::steady_clock::now();
+
+        // Only processes whose name matches are ever opened, and only with the rights needed to close them
+        std::vector<kill_engine::target> targets;
+        for(uint32_t pid : pids) {
+            HANDLE proc = OpenProcess(PROCESS_TERMINATE | SYNCHRONIZE, false, pid);
+            if(proc)
+                targets.push_back({ pid, proc });
+        }
+
+        // Targets are sorted by PID, so windows can be attributed without building a map of every window
+        auto cb = [](HWND hwnd, LPARAM targets_) -> BOOL {
+            auto& targets = *reinterpret_cast<std::vector<kill_engine::target>*>(targets_);
+
+            DWORD pid;
+            GetWindowThreadProcessId(hwnd, &pid);
+            auto it = std::lower_bound(targets.begin(), targets.end(), pid, [](const kill_engine::target& t, DWORD p) { return t.pid < p; });
+            if(it != targets.end() && it->pid == pid)
+                it->windows.push_back(hwnd);
+
+            return true;
+        };
+        if(!targets.empty())
+            EnumWindows(cb, reinterpret_cast<LPARAM>(&targets));
+
+        post([this, targets = std::move(targets), grace, start]() mutable {
+            [[maybe_unused]] auto outcomes = kill_engine(grace).run(std::move(targets));
+            if(kill_histogram_)
+                kill_histogram_->record_since(start);
+#ifdef _DEBUG
+            for(const auto& o : outcomes) {
+                const char* how = o.how == kill_engine::result::CLOSED ? "closed" : o.how == kill_engine::result::TERMINATED ? "terminated" : "failed";
+                OutputDebugStringA(std::format("Process {} {} after {} ms\n", o.pid, how, o.elapsed.count()).c_str());
+            }
+#endif
+        });
+    }
+
+    void set_start_histogram(metrics_registry::histogram* histogram) override {
+        supervisor_.set_round_histogram(histogram);
+    }
+
+    void set_kill_histogram(metrics_registry::histogram* histogram) override {
+        kill_histogram_ = histogram;
+    }
+
+private:
+    void post(std::function<void()> job) {
+        {
+            std::lock_guard lock(mutex_);
+            jobs_.push_back(std::move(job));
+            if(!worker_.joinable())
+                worker_ = std::thread([this]() { run(); });
+        }
+        wake_.notify_one();
+    }
+
+    void run() {
+        std::unique_lock lock(mutex_);
+        while(true) {
+            wake_.wait(lock, [this]() { return stopping_ || !jobs_.empty(); });
+            if(jobs_.empty())
+                break;
+
+            auto job = std::move(jobs_.front());
+            jobs_.pop_front();
+            lock.unlock();
+            job();
+            lock.lock();
+        }
+    }
+
+    process_supervisor supervisor_;
+    metrics_registry::histogram* kill_histogram_ = nullptr;
+
+    std::mutex mutex_;
+    std::condition_variable wake_;
+    std::thread worker_;
+    std::deque<std::function<void()>> jobs_;
+    bool stopping_ = false;
+};
@@ -0,0 +1,73 @@
+#pragma once
+#include <windows.h>
+#include <utility>
+#include <vector>
+
+#include "Reactor.h"
+
+// Waits on registered handles and the thread's message queue at once, so the reactor thread also pumps
+// window messages. WM_QUIT stops the reactor.
+class win32_reactor : public reactor {
+public:
+    win32_reactor() {
+        wake_ = CreateEvent(nullptr, false, false, nullptr);
+    }
+
+    ~win32_reactor() override {
+        CloseHandle(wake_);
+    }
+
+    win32_reactor(const win32_reactor&) = delete;
+    win32_reactor& operator=(const win32_reactor&) = delete;
+
+    // Reactor thread only. fn runs whenever the handle is signaled; auto-reset handles suit this best.
+    void add_handle(HANDLE handle, task fn) {
+        handles_.push_back(handle);
+        handlers_.push_back(std::move(fn));
+    }
+
+    void remove_handle(HANDLE handle) {
+        for(size_t i = 0; i < handles_.size(); i++) {
+            if(handles_[i] == handle) {
+                handles_.erase(handles_.begin() + i);
+                handlers_.erase(handlers_.begin() + i);
+                return;
+            }
+        }
+    }
+
+protected:
+    void wait(std::optional<clock::duration> timeout) override {
+        waiting_.assign(1, wake_);
+        waiting_.insert(waiting_.end(), handles_.begin(), handles_.end());
+        const DWORD count = static_cast<DWORD>(waiting_.size());
+
+        DWORD rval = MsgWaitForMultipleObjectsEx(count, waiting_.data(), timeout ? timeout_ms(*timeout) : INFINITE,
+                                                 QS_ALLINPUT, MWMO_INPUTAVAILABLE);
+        if(rval > WAIT_OBJECT_0 && rval < WAIT_OBJECT_0 + count) {
+            // The handler may unregister itself
+            task fn = handlers_[rval - WAIT_OBJECT_0 - 1];
+            fn();
+        } else if(rval == WAIT_OBJECT_0 + count) {
+            MSG msg;
+            while(PeekMessage(&msg, nullptr, 0, 0, PM_REMOVE)) {
+                if(msg.message == WM_QUIT) {
+                    stop();
+                    break;
+                }
+                TranslateMessage(&msg);
+                DispatchMessage(&msg);
+            }
+        }
+    }
+
+    void notify() override {
+        SetEvent(wake_);
+    }
+
+private:
+    HANDLE wake_;
+    std::vector<HANDLE> handles_;
+    std::vector<task> handlers_;
+    std::vector<HANDLE> waiting_;
+};
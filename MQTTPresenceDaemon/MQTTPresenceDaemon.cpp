@@ -0,0 +1,352 @@
+// Headless Linux build of the presence core: the same config file, presence rule, MQTT client and actions as the
+// tray app, with /proc, /proc/asound and inotify standing in for the Windows backends. Nothing on Linux senses
+// user activity yet, so the "user" check stays off and the default rule follows sound alone.
+//
+// Built against the same vcpkg dependencies as the tray app by the CMakeLists.txt at the top of the repository.
+
+#include <signal.h>
+#include <sys/signalfd.h>
+#include <unistd.h>
+
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <thread>
+
+#include <nlohmann/json.hpp>
+#include <cxxopts.hpp>
+
+#include "MQTTPresence.h"
+#include "MQTTClient.h"
+
+#include "ActionEngine.h"
+#include "Benchmark.h"
+#include "Config.h"
+#include "EpollReactor.h"
+#include "FileWatch.h"
+#include "InotifyWatch.h"
+#include "Metrics.h"
+#include "PosixActionBackend.h"
+#include "PosixMappedFile.h"
+#include "PresenceEngine.h"
+#include "ProcAsoundAudioSource.h"
+#include "ProcfsProcessInventory.h"
+#include "Teardown.h"
+#include "TransitionJournal.h"
+#include "VolumeWorker.h"
+
+// Constants //
+// Service managers escalate to SIGKILL some seconds after SIGTERM, so teardown has to be done well before that
+std::chrono::milliseconds const g_teardown_budget(3000);
+// Transitions kept for replay to the history topic, 16 bytes each
+uint32_t const g_journal_capacity = 4096;
+
+// Main Loop //
+std::atomic<std::shared_ptr<mqtt_client>> g_mqtt;
+// Disconnects a client replaced by a reload, so its final flush never holds up the reactor
+std::thread g_retired_mqtt;
+std::filesystem::path g_config_path;
+std::atomic<std::shared_ptr<const config>> g_config;
+process_selector g_process_selector(std::make_unique<procfs_process_inventory>());
+action_engine g_actions(g_process_selector, std::make_unique<posix_action_backend>(g_process_selector));
+
+// Published as diagnostic sensors, under the same names as the tray app's
+metrics_registry g_metrics;
+metrics_registry::histogram& g_publish_latency = g_metrics.add_histogram("publish_latency");
+metrics_registry::counter& g_reconnects = g_metrics.add_counter("reconnects");
+metrics_registry::histogram& g_volume_poll_time = g_metrics.add_histogram("volume_poll");
+metrics_registry::counter& g_sessions_scanned = g_metrics.add_counter("sessions_scanned");
+metrics_registry::histogram& g_kill_time = g_metrics.add_histogram("kill_action");
+metrics_registry::histogram& g_start_time = g_metrics.add_histogram("start_action");
+metrics_registry::histogram& g_reload_time = g_metrics.add_histogram("config_reload");
+metrics_registry::gauge& g_reactor_wakeups = g_metrics.add_gauge("reactor_wakeups");
+metrics_registry::gauge& g_sound_polls_per_hour = g_metrics.add_gauge("sound_polls_per_hour");
+metrics_registry::gauge& g_queue_depth = g_metrics.add_gauge("publish_queue_depth");
+metrics_registry::gauge& g_queue_dropped = g_metrics.add_gauge("publish_queue_dropped");
+metrics_registry::gauge& g_discovery_published = g_metrics.add_gauge("discovery_published");
+metrics_registry::gauge& g_discovery_skipped = g_metrics.add_gauge("discovery_skipped");
+metrics_registry::gauge& g_journal_pending = g_metrics.add_gauge("journal_pending");
+metrics_registry::gauge& g_journal_lost = g_metrics.add_gauge("journal_lost");
+
+// Everything after startup runs on this thread: signals, timers, the config watch, volume polling and
+// reconnecting to the broker.
+epoll_reactor g_reactor;
+std::unique_ptr<file_watch> g_config_watch;
+
+// Appended to on the reactor thread only
+std::unique_ptr<posix_mapped_file> g_journal_file;
+std::unique_ptr<transition_journal> g_journal;
+
+// Set while main_loop runs
+volume_worker* g_volume = nullptr;
+
+presence_engine g_presence;
+presence_engine::sensor_id g_user_sensor = g_presence.add_sensor("user");
+presence_engine::sensor_id g_sound_sensor = g_presence.add_sensor("sound");
+
+[[noreturn]] void fatal(const std::string& message) {
+    std::cerr << g_unique_identifier << ": " << message << '\n';
+    exit(1);
+}
+
+// Publishes each sensor on its own topic
+void on_sensor_change(presence_engine::sensor_id sensor, bool value) {
+    if(g_journal) {
+        auto now = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch());
+        g_journal->append(now.count(), static_cast<uint8_t>(sensor), value, g_presence.present());
+    }
+
+    auto mqtt = g_mqtt.load();
+    if(!mqtt)
+        return;
+
+    if(sensor == g_user_sensor)
+        mqtt->user_active(value);
+    else if(sensor == g_sound_sensor)
+        mqtt->sound_active(value);
+}
+
+void on_presence_change(bool present) {
+    if(auto cfg = g_config.load())
+        g_actions.on_presence_change(*cfg, present);
+}
+
+void on_mqtt_status(mqtt_status status) {
+    if(status == mqtt_status::CONNECTING)
+        std::cerr << "Connection lost, reconnecting...\n";
+    else if(status == mqtt_status::CONNECTED)
+        std::cerr << "Connected.\n";
+}
+
+// Copies the stats components keep themselves into the registry; runs on the reactor thread before each snapshot
+void collect_metrics() {
+    g_reactor_wakeups.set(static_cast<double>(g_reactor.get_stats().wakeups));
+    if(g_volume)
+        g_sound_polls_per_hour.set(g_volume->sampler_stats().polls_per_hour);
+    if(auto mqtt = g_mqtt.load()) {
+        auto queue = mqtt->queue_stats();
+        g_queue_depth.set(static_cast<double>(queue.depth));
+        g_queue_dropped.set(static_cast<double>(queue.dropped));
+        auto discovery = mqtt->discovery_stats();
+        g_discovery_published.set(static_cast<double>(discovery.published));
+        g_discovery_skipped.set(static_cast<double>(discovery.skipped));
+    }
+    if(g_journal) {
+        auto journal = g_journal->get_stats();
+        g_journal_pending.set(static_cast<double>(journal.pending));
+        g_journal_lost.set(static_cast<double>(journal.lost));
+    }
+}
+
+std::shared_ptr<mqtt_client> make_mqtt_client(const config& cfg) {
+    auto mqtt = std::make_shared<mqtt_client>(cfg.mqtt_host, cfg.mqtt_port, cfg.mqtt_username, cfg.mqtt_password, cfg.mqtt_topic,
+                                              cfg.mqtt_keep_alive, cfg.state_refresh_interval, cfg.publish_policies, g_reactor,
+                                              g_presence, g_user_sensor, g_sound_sensor, cfg.consolidated_state);
+    mqtt->set_status_handler(on_mqtt_status);
+    mqtt->set_journal(g_journal.get());
+    mqtt->set_metrics({ &g_metrics, cfg.diagnostics_interval, &g_publish_latency, &g_reconnects });
+    return mqtt;
+}
+
+std::unique_ptr<audio_source> make_audio_source(const config&) {
+    return std::make_unique<proc_asound_audio_source>();
+}
+
+// Returns nullptr if the file cannot be parsed, e.g. when caught halfway through being saved.
+std::shared_ptr<const config> read_config() {
+    try {
+        std::ifstream cfg_file(g_config_path);
+        return parse_config(nlohmann::json::parse(cfg_file, nullptr, true, true));
+    } catch(const nlohmann::json::exception&) {
+        return nullptr;
+    }
+}
+
+// $XDG_CONFIG_HOME/mqttpresence/config.json, falling back to ~/.config as the XDG spec does
+std::filesystem::path default_config_path() {
+    std::filesystem::path base;
+    if(const char* xdg = std::getenv("XDG_CONFIG_HOME"); xdg && *xdg)
+        base = xdg;
+    else if(const char* home = std::getenv("HOME"))
+        base = std::filesystem::path(home) / ".config";
+    return base / "mqttpresence" / "config.json";
+}
+
+// Disconnects a replaced client on its own thread within g_teardown_budget. A previous one still flushing is
+// waited for first, so at most one is in flight.
+void retire_mqtt(std::shared_ptr<mqtt_client> mqtt) {
+    if(g_retired_mqtt.joinable())
+        g_retired_mqtt.join();
+    g_retired_mqtt = std::thread([mqtt = std::move(mqtt)]() {
+        teardown_timer timer(g_teardown_budget);
+        mqtt->disconnect(timer.deadline());
+    });
+}
+
+// Applies a reloaded configuration section by section, like the tray app; there is no activity section here.
+// Returns false if a section was rejected and kept its previous settings.
+bool apply_config(const std::shared_ptr<const config>& next, volume_worker& volume) {
+    auto prev = g_config.exchange(next);
+    unsigned changed = diff_config(*prev, *next);
+
+    if(changed & CONFIG_START)
+        g_actions.set_start_entries(next->start_processes);
+
+    bool ok = true;
+    if(changed & CONFIG_PRESENCE)
+        ok = g_presence.set_rule(next->presence_rule);
+
+    if(changed & CONFIG_VOLUME) {
+        // A fresh worker starts out silent and only reports flips, so the sensor has to start out silent too
+        volume.stop();
+        g_presence.set(g_sound_sensor, false);
+        if(next->enable_volume)
+            volume.start(*next);
+    } else {
+        if(changed & CONFIG_VOLUME_PROCESSES)
+            volume.set_process_matcher(next->volume_matcher);
+        if(changed & CONFIG_SOUND_SAMPLING)
+            volume.set_sampler_settings(next->sound_sampling);
+    }
+
+    if(changed & CONFIG_MQTT) {
+        if(auto old = g_mqtt.exchange(nullptr))
+            retire_mqtt(std::move(old));
+
+        auto mqtt = make_mqtt_client(*next);
+        g_mqtt = mqtt;
+        mqtt->connect();
+    }
+
+    return ok;
+}
+
+// Runs on the reactor thread once the config file settled with new content
+void reload_config() {
+    auto since = std::chrono::steady_clock::now();
+    auto next = read_config();
+    if(!next || !g_volume)
+        return;
+
+    bool ok = apply_config(next, *g_volume);
+    g_reload_time.record_since(since);
+    std::cerr << (ok ? "Configuration reloaded.\n" : "Configuration reloaded, but presenceRule is invalid and was not changed.\n");
+}
+
+void load_config() {
+    auto cfg = read_config();
+    if(!cfg)
+        fatal("could not read " + g_config_path.string());
+
+    g_config = cfg;
+    g_actions.set_start_entries(cfg->start_processes);
+    if(!g_presence.set_rule(cfg->presence_rule))
+        fatal("invalid presenceRule in " + g_config_path.string());
+
+    // Without a journal transitions are still published, just not kept for the history topic
+    g_journal_file = std::make_unique<posix_mapped_file>(g_config_path.parent_path() / "journal.bin",
+                                                         transition_journal::bytes_for(g_journal_capacity));
+    if(*g_journal_file)
+        g_journal = std::make_unique<transition_journal>(g_journal_file->data(), g_journal_capacity);
+
+    g_config_watch = std::make_unique<file_watch>(g_reactor, std::make_unique<inotify_watch>(g_reactor, g_config_path), g_config_path, reload_config);
+}
+
+void parse_options(int argc, char** argv) {
+    cxxopts::Options options(g_unique_identifier, "Reports presence to MQTT from a headless Linux machine");
+    options.add_options()
+        ("c,config", "Config file", cxxopts::value<std::string>()->default_value(default_config_path().string()))
+        ("b,benchmark", "Run the benchmark suite, write its JSON results to this file and exit, failing if anything is over budget", cxxopts::value<std::string>());
+
+    auto result = options.parse(argc, argv);
+
+    if(result.count("b")) {
+        auto results = benchmark_suite().run();
+        std::ofstream out(result["b"].as<std::string>());
+        out << results.dump(2) << '\n';
+        if(!results["over_budget"].empty())
+            std::cerr << "Over budget: " << results["over_budget"].dump() << '\n';
+        exit(out && results["over_budget"].empty() ? 0 : 1);
+    }
+
+    g_config_path = result["c"].as<std::string>();
+}
+
+// SIGINT and SIGTERM stop the reactor, after which main_loop tears down within g_teardown_budget
+int watch_signals() {
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+
+    int fd = signalfd(-1, &signals, SFD_NONBLOCK | SFD_CLOEXEC);
+    if(fd >= 0) {
+        g_reactor.add_fd(fd, [fd]() {
+            signalfd_siginfo info;
+            while(read(fd, &info, sizeof(info)) == sizeof(info))
+                ;
+            g_reactor.stop();
+        });
+    }
+    return fd;
+}
+
+void main_loop() {
+    auto cfg = g_config.load();
+    g_mqtt = make_mqtt_client(*cfg);
+
+    volume_worker volume(g_reactor, make_audio_source, [](bool active) { g_presence.set(g_sound_sensor, active); });
+    volume.set_metrics(&g_volume_poll_time, &g_sessions_scanned);
+    if(cfg->enable_volume)
+        volume.start(*cfg);
+    g_volume = &volume;
+
+    g_mqtt.load()->connect();
+    if(cfg->enable_volume)
+        g_presence.set(g_sound_sensor, false);
+
+    g_reactor.run();
+
+    // The final OFF states go out with the disconnect, which is bounded by the teardown budget
+    teardown_timer timer(g_teardown_budget);
+    auto mqtt = g_mqtt.exchange(nullptr);
+    volume.stop();
+    g_volume = nullptr;
+    g_actions.begin_teardown(timer.deadline());
+    g_presence.set(g_sound_sensor, false);
+    g_presence.set(g_user_sensor, false);
+    timer.mark("presence");
+
+    bool delivered = !mqtt || mqtt->disconnect(timer.deadline());
+    if(g_retired_mqtt.joinable())
+        g_retired_mqtt.join();
+    timer.mark("mqtt");
+    if(!delivered || timer.overran())
+        std::cerr << "Shutdown took " << timer.total().count() / 1000 << " ms" << (delivered ? "" : ", final states not confirmed") << '\n';
+}
+
+int main(int argc, char** argv) {
+    parse_options(argc, argv);
+
+    // Blocked before any thread starts, so every thread inherits the mask and only the signalfd sees them
+    int signals = watch_signals();
+
+    g_presence.on_sensor_change(on_sensor_change);
+    g_presence.on_presence_change(on_presence_change);
+    g_actions.set_metrics(&g_start_time, &g_kill_time);
+    g_metrics.on_collect(collect_metrics);
+    load_config();
+
+    main_loop();
+
+    g_config_watch.reset();
+    if(signals >= 0) {
+        g_reactor.remove_fd(signals);
+        close(signals);
+    }
+
+    return 0;
+}
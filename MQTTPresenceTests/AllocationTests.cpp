@@ -0,0 +1,97 @@
+// A state change has to reach the publish queue without touching the heap. Every allocation in the process is
+// counted here, so the checks cover the queue's sender thread as well as the publishing one.
+
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <new>
+
+#include "PresenceEngine.h"
+#include "PublishQueue.h"
+#include "StatePublisher.h"
+#include "TestHarness.h"
+
+static std::atomic<size_t> g_allocations = 0;
+
+// Every replaceable form is replaced, so nothing allocated here is freed by the library's own operator delete
+void* operator new(size_t size) {
+    g_allocations.fetch_add(1, std::memory_order_relaxed);
+    if(void* p = std::malloc(size ? size : 1))
+        return p;
+    throw std::bad_alloc();
+}
+
+void* operator new[](size_t size) {
+    return operator new(size);
+}
+
+void operator delete(void* p) noexcept {
+    std::free(p);
+}
+
+void operator delete[](void* p) noexcept {
+    operator delete(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+    operator delete(p);
+}
+
+void operator delete[](void* p, size_t) noexcept {
+    operator delete(p);
+}
+
+namespace {
+
+mqtt::message_ptr make_state_message(const std::string& topic, const std::string& payload, message_class cls) {
+    return mqtt::make_message(topic, payload, 1, cls == message_class::STATE);
+}
+
+// Runs the path mqtt_client::user_active()/sound_active() take: the presence engine reports a sensor change, and
+// the state is published into the client's queue, whose sender stands in for paho.
+size_t count_steady_state_allocations(bool consolidated) {
+    std::atomic<uint64_t> sent = 0;
+    publish_queue queue(16, [&sent](const mqtt::const_message_ptr&) {
+        sent++;
+        return true;
+    });
+
+    state_publisher states("homeassistant/binary_sensor/test", { "user", "sound" }, consolidated, make_state_message);
+    states.register_topics(queue);
+
+    presence_engine presence;
+    auto user = presence.add_sensor("user");
+    auto sound = presence.add_sensor("sound");
+    presence.on_sensor_change([&](presence_engine::sensor_id sensor, bool value) {
+        states.publish(queue, sensor == user ? 0 : 1, value);
+    });
+
+    // Warm up: the sender thread, the slots' first messages and the handler are all in place afterwards
+    for(int i = 0; i < 4; i++) {
+        presence.set(user, i & 1);
+        presence.set(sound, i & 2);
+        queue.flush(std::chrono::seconds(1));
+    }
+
+    size_t before = g_allocations.load();
+    for(int i = 0; i < 20000; i++) {
+        presence.set(user, i & 1);
+        presence.set(sound, (i / 3) & 1);
+        states.publish(queue, 1, presence.sensor(sound), i % 100 == 0);
+    }
+    queue.flush(std::chrono::seconds(5));
+    size_t allocations = g_allocations.load() - before;
+
+    CHECK(sent.load() > 4);
+    return allocations;
+}
+
+} // namespace
+
+TEST(steady_state_publishes_do_not_allocate) {
+    CHECK(count_steady_state_allocations(false) == 0);
+}
+
+TEST(consolidated_publishes_do_not_allocate) {
+    CHECK(count_steady_state_allocations(true) == 0);
+}
@@ -0,0 +1,26 @@
+#include <chrono>
+
+#include "Backoff.h"
+#include "TestHarness.h"
+
+using namespace std::chrono_literals;
+
+TEST(backoff_delays_stay_within_their_jittered_step) {
+    for(int run = 0; run < 100; run++) {
+        jittered_backoff backoff(1000ms, 60000ms);
+        auto step = 1000ms;
+        for(int attempt = 0; attempt < 10; attempt++) {
+            auto delay = backoff.next();
+            CHECK(delay >= step / 2 && delay <= step);
+            step = std::min(step * 2, 60000ms);
+        }
+    }
+}
+
+TEST(backoff_reset_starts_from_the_initial_step) {
+    jittered_backoff backoff(1000ms, 60000ms);
+    for(int attempt = 0; attempt < 8; attempt++)
+        backoff.next();
+    backoff.reset();
+    CHECK(backoff.next() <= 1000ms);
+}
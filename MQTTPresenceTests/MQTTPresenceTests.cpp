@@ -0,0 +1,23 @@
+// Tests for the platform-independent parts of the presence core, built for Linux like the daemon and run by ctest.
+// Runs every test, or only those whose name contains the first argument, and exits non-zero if any check failed.
+
+#include <cstring>
+
+#include "TestHarness.h"
+
+int main(int argc, char** argv) {
+    const char* filter = argc > 1 ? argv[1] : "";
+    int run = 0;
+    for(const auto& t : test_registry()) {
+        if(!std::strstr(t.name, filter))
+            continue;
+
+        int failures = test_failures();
+        t.run();
+        std::printf("%s %s\n", test_failures() == failures ? "PASS" : "FAIL", t.name);
+        run++;
+    }
+
+    std::printf("%d tests, %d failed checks\n", run, test_failures());
+    return test_failures() == 0 ? 0 : 1;
+}
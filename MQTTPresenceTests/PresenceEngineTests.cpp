@@ -0,0 +1,101 @@
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "PresenceEngine.h"
+#include "TestHarness.h"
+
+namespace {
+
+// Records the engine's callbacks as e.g. "user+" for a sensor and "present"/"absent" for the fused state
+struct recorder {
+    presence_engine engine;
+    std::vector<std::string> events;
+
+    recorder() {
+        engine.on_sensor_change([this](presence_engine::sensor_id sensor, bool value) {
+            events.push_back(engine.name(sensor) + (value ? "+" : "-"));
+        });
+        engine.on_presence_change([this](bool present) { events.push_back(present ? "present" : "absent"); });
+    }
+
+    std::vector<std::string> take() { return std::exchange(events, {}); }
+};
+
+using events = std::vector<std::string>;
+
+} // namespace
+
+TEST(default_rule_is_present_while_any_sensor_is) {
+    recorder r;
+    auto user = r.engine.add_sensor("user");
+    auto sound = r.engine.add_sensor("sound");
+
+    r.engine.set(user, true);
+    r.engine.set(sound, true);
+    r.engine.set(user, false);
+    r.engine.set(sound, false);
+    CHECK(r.take() == (events { "user+", "present", "sound+", "user-", "sound-", "absent" }));
+
+    // Repeating a sensor's value is not a change
+    r.engine.set(sound, false);
+    CHECK(r.take().empty());
+}
+
+TEST(compound_rule_with_negation) {
+    recorder r;
+    auto user = r.engine.add_sensor("user");
+    auto sound = r.engine.add_sensor("sound");
+    auto locked = r.engine.add_sensor("locked");
+    CHECK(r.engine.set_rule("(user | sound) & !locked"));
+
+    r.engine.set(sound, true);
+    r.engine.set(locked, true);
+    r.engine.set(user, true);
+    r.engine.set(locked, false);
+    CHECK(r.take() == (events { "sound+", "present", "locked+", "absent", "user+", "locked-", "present" }));
+}
+
+TEST(invalid_rules_are_rejected_and_the_previous_one_kept) {
+    recorder r;
+    auto user = r.engine.add_sensor("user");
+    r.engine.add_sensor("sound");
+    CHECK(r.engine.set_rule("user"));
+
+    CHECK(!r.engine.set_rule("user | nope"));
+    CHECK(!r.engine.set_rule("user |"));
+    CHECK(!r.engine.set_rule("(user"));
+    CHECK(!r.engine.set_rule("user sound"));
+
+    r.engine.set(user, true);
+    CHECK(r.engine.present());
+}
+
+TEST(changing_the_rule_reevaluates_presence) {
+    recorder r;
+    r.engine.add_sensor("user");
+    auto sound = r.engine.add_sensor("sound");
+
+    r.engine.set(sound, true);
+    CHECK(r.take() == (events { "sound+", "present" }));
+    CHECK(r.engine.set_rule("user"));
+    CHECK(r.take() == (events { "absent" }));
+    CHECK(r.engine.set_rule(""));
+    CHECK(r.take() == (events { "present" }));
+}
+
+TEST(every_sensor_combination_follows_the_rule) {
+    presence_engine engine;
+    std::vector<presence_engine::sensor_id> sensors;
+    for(const char* name : { "a", "b", "c", "d" })
+        sensors.push_back(engine.add_sensor(name));
+    CHECK(engine.set_rule("(a & !b) | (c & d)"));
+
+    for(unsigned mask = 0; mask < 16; mask++) {
+        for(size_t i = 0; i < sensors.size(); i++)
+            engine.set(sensors[i], (mask >> i) & 1);
+
+        bool a = mask & 1, b = mask & 2, c = mask & 4, d = mask & 8;
+        CHECK(engine.present() == ((a && !b) || (c && d)));
+    }
+}
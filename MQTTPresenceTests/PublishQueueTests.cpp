@@ -0,0 +1,114 @@
+// The publish queue as the MQTT client drives it across a lost connection: paused while offline, invalidated and
+// resumed on reconnect. The sender stands in for the broker, so no broker is needed.
+
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "PublishQueue.h"
+#include "TestHarness.h"
+
+namespace {
+
+using namespace std::chrono_literals;
+
+struct broker_stand_in {
+    std::mutex mutex;
+    std::vector<std::string> received;
+    bool reachable = true;
+
+    publish_queue::sender_t sender() {
+        return [this](const mqtt::const_message_ptr& msg) {
+            std::lock_guard lock(mutex);
+            if(!reachable)
+                return false;
+            received.push_back(msg->get_payload_str());
+            return true;
+        };
+    }
+
+    void set_reachable(bool value) {
+        std::lock_guard lock(mutex);
+        reachable = value;
+    }
+
+    std::vector<std::string> take() {
+        std::lock_guard lock(mutex);
+        return std::exchange(received, {});
+    }
+};
+
+mqtt::const_message_ptr state(const char* payload) {
+    return mqtt::make_message("presence/user/state", payload, 1, true);
+}
+
+} // namespace
+
+TEST(paused_queue_keeps_only_the_latest_state) {
+    broker_stand_in broker;
+    publish_queue queue(4, broker.sender());
+    auto slot = queue.register_topic("presence/user/state");
+
+    queue.pause();
+    queue.enqueue(slot, state("ON"));
+    queue.enqueue(slot, state("OFF"));
+    queue.enqueue(slot, state("ON"));
+    CHECK(!queue.flush(50ms));
+    CHECK(broker.take().empty());
+
+    queue.resume();
+    CHECK(queue.flush(1s));
+    CHECK(broker.take() == std::vector<std::string> { "ON" });
+    CHECK(queue.get_stats().coalesced == 2);
+}
+
+TEST(reconnect_resends_what_the_broker_may_have_lost) {
+    broker_stand_in broker;
+    publish_queue queue(4, broker.sender());
+    auto slot = queue.register_topic("presence/user/state");
+
+    queue.enqueue(slot, state("ON"));
+    CHECK(queue.flush(1s));
+    queue.enqueue(slot, state("ON"));
+    CHECK(queue.flush(1s));
+    CHECK(broker.take() == std::vector<std::string> { "ON" });
+    CHECK(queue.get_stats().suppressed == 1);
+
+    queue.pause();
+    queue.invalidate();
+    queue.resume();
+    queue.enqueue(slot, state("ON"));
+    CHECK(queue.flush(1s));
+    CHECK(broker.take() == std::vector<std::string> { "ON" });
+}
+
+TEST(failed_send_is_retried_on_the_next_state) {
+    broker_stand_in broker;
+    publish_queue queue(4, broker.sender());
+    auto slot = queue.register_topic("presence/user/state");
+
+    broker.set_reachable(false);
+    queue.enqueue(slot, state("ON"));
+    CHECK(queue.flush(1s));
+    CHECK(queue.get_stats().failed == 1);
+
+    broker.set_reachable(true);
+    queue.enqueue(slot, state("ON"));
+    CHECK(queue.flush(1s));
+    CHECK(broker.take() == std::vector<std::string> { "ON" });
+}
+
+TEST(stopped_queue_drops_what_was_buffered) {
+    broker_stand_in broker;
+    publish_queue queue(4, broker.sender());
+    auto slot = queue.register_topic("presence/user/state");
+
+    queue.pause();
+    queue.enqueue(slot, state("OFF"));
+    queue.stop();
+    CHECK(broker.take().empty());
+    CHECK(queue.get_stats().dropped == 1);
+    CHECK(!queue.enqueue(slot, state("ON")));
+}
@@ -0,0 +1,36 @@
+#pragma once
+#include <cstdio>
+#include <vector>
+
+// Just enough of a harness for the core's portable pieces: TEST(name) registers a case, CHECK(expr) records a
+// failure and carries on, so one run reports every broken expectation.
+struct test_case {
+    const char* name;
+    void (*run)();
+};
+
+inline std::vector<test_case>& test_registry() {
+    static std::vector<test_case> tests;
+    return tests;
+}
+
+inline int& test_failures() {
+    static int failures = 0;
+    return failures;
+}
+
+inline void test_failed(const char* file, int line, const char* expr) {
+    std::fprintf(stderr, "%s:%d: CHECK(%s) failed\n", file, line, expr);
+    test_failures()++;
+}
+
+#define TEST(name)                                                                                    \
+    static void name();                                                                              \
+    [[maybe_unused]] static const bool name##_registered = (test_registry().push_back({ #name, name }), true); \
+    static void name()
+
+#define CHECK(expr)                                \
+    do {                                           \
+        if(!(expr))                                \
+            test_failed(__FILE__, __LINE__, #expr); \
+    } while(0)
@@ -0,0 +1,79 @@
+#include <atomic>
+#include <cstdint>
+#include <thread>
+#include <vector>
+
+#include "TestHarness.h"
+#include "TransitionJournal.h"
+
+TEST(journal_reopened_over_the_same_memory_keeps_its_marks) {
+    std::vector<char> memory(transition_journal::bytes_for(8));
+    {
+        transition_journal journal(memory.data(), 8);
+        for(int i = 0; i < 5; i++)
+            journal.append(1000 + i, i % 2, i % 2, true);
+        auto b = journal.read(3);
+        CHECK(b.first == 0 && b.next == 3 && b.records.size() == 3);
+        journal.acknowledge(b.next);
+    }
+
+    transition_journal journal(memory.data(), 8);
+    auto s = journal.get_stats();
+    CHECK(s.appended == 5 && s.acknowledged == 3 && s.pending == 2 && s.lost == 0);
+    auto b = journal.read(10);
+    CHECK(b.records.size() == 2 && b.records[0].time == 1003);
+}
+
+TEST(journal_reopened_with_another_capacity_starts_empty) {
+    std::vector<char> memory(transition_journal::bytes_for(16));
+    {
+        transition_journal journal(memory.data(), 8);
+        journal.append(1, 0, true, true);
+    }
+
+    transition_journal journal(memory.data(), 16);
+    CHECK(journal.get_stats().appended == 0);
+    CHECK(journal.read(10).records.empty());
+}
+
+TEST(lapped_journal_counts_what_it_overwrote) {
+    std::vector<char> memory(transition_journal::bytes_for(8));
+    transition_journal journal(memory.data(), 8);
+    for(int i = 0; i < 20; i++)
+        journal.append(2000 + i, 0, true, true);
+
+    // One slot is held back for a record being written, so 7 of the last records are readable
+    auto s = journal.get_stats();
+    CHECK(s.pending == 7 && s.lost == 13);
+    auto b = journal.read(100);
+    CHECK(b.first == 13 && b.records.size() == 7 && b.records[0].time == 2013 && b.records[0].seq == 13);
+}
+
+TEST(journal_reader_never_sees_a_torn_record) {
+    std::vector<char> memory(transition_journal::bytes_for(64));
+    transition_journal journal(memory.data(), 64);
+
+    // The writer keeps lapping the reader until it has read enough to have raced it many times
+    std::atomic<bool> done = false;
+    std::atomic<uint64_t> read = 0;
+    std::thread writer([&]() {
+        for(int64_t i = 0; read < 1000 && i < 50000000; i++)
+            journal.append(i, 0, true, false);
+        done = true;
+    });
+
+    uint64_t torn = 0;
+    while(!done) {
+        auto b = journal.read(64);
+        for(size_t k = 0; k < b.records.size(); k++) {
+            if(b.records[k].time != static_cast<int64_t>(b.first + k) || b.records[k].seq != static_cast<uint32_t>(b.first + k))
+                torn++;
+        }
+        read += b.records.size();
+        journal.acknowledge(b.next);
+    }
+    writer.join();
+
+    CHECK(read >= 1000);
+    CHECK(torn == 0);
+}
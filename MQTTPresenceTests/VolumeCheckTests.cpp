@@ -0,0 +1,111 @@
+#include <chrono>
+#include <cmath>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "FakeAudioSource.h"
+#include "LevelWindow.h"
+#include "SoundSampler.h"
+#include "TestHarness.h"
+#include "VolumeCheck.h"
+
+using namespace std::chrono_literals;
+
+TEST(level_window_reduces_each_column_over_recent_rows) {
+    level_window window;
+    window.reset(2, 4);
+    for(float level : { 0.f, 0.5f, 0.f, 0.f }) {
+        float* row = window.next_row();
+        row[0] = level;
+        row[1] = 0.25f;
+    }
+
+    std::vector<float> max, rms;
+    window.compute(4, max, rms);
+    CHECK(max[0] == 0.5f && max[1] == 0.25f);
+    CHECK(std::abs(rms[0] - 0.25f) < 1e-6f && std::abs(rms[1] - 0.25f) < 1e-6f);
+
+    // The loud row has scrolled out of the two most recent ones
+    window.compute(2, max, rms);
+    CHECK(max[0] == 0.f);
+}
+
+TEST(level_window_keeps_history_when_grown) {
+    level_window window;
+    window.reset(1, 3);
+    window.next_row()[0] = 0.75f;
+    window.grow(3);
+
+    std::vector<float> max, rms;
+    window.compute(3, max, rms);
+    CHECK(max.size() == 3 && max[0] == 0.75f && max[1] == 0.f && max[2] == 0.f);
+}
+
+TEST(blip_between_polls_makes_the_poll_active) {
+    auto source = std::make_unique<fake_audio_source>();
+    auto* fake = source.get();
+    volume_check check(std::move(source), 52);
+    for(uint32_t pid = 100; pid < 116; pid++)
+        fake->add_session(pid, L"/usr/bin/player" + std::to_wstring(pid), 0.f);
+
+    for(int tick = 0; tick < 50; tick++) {
+        fake->set_peak(105, tick == 20 ? 0.3f : 0.f);
+        check.sample();
+    }
+    CHECK(check.poll());
+    CHECK(check.last_levels().max == 0.3f);
+
+    for(int tick = 0; tick < 50; tick++)
+        check.sample();
+    CHECK(!check.poll());
+}
+
+TEST(only_matching_processes_count_as_sound) {
+    auto source = std::make_unique<fake_audio_source>();
+    auto* fake = source.get();
+    volume_check check(std::move(source));
+    check.set_process_matcher(process_matcher({ L"player" }));
+
+    fake->add_session(1, L"/usr/bin/notifier", 0.5f);
+    CHECK(!check.poll());
+    fake->add_session(2, L"/usr/bin/player", 0.5f);
+    CHECK(check.poll());
+    fake->remove_session(2);
+    CHECK(!check.poll());
+
+    // Resolved paths are cached per process, including the one that never matches
+    auto stats = check.name_cache_stats();
+    CHECK(stats.misses == 2 && stats.hits >= 1);
+}
+
+TEST(sampler_reports_off_only_after_the_off_delay) {
+    auto start = sound_sampler::clock::now();
+    sound_sampler_settings settings;
+    settings.on_delay = 0ms;
+    settings.off_delay = 1000ms;
+    sound_sampler sampler(settings, start);
+
+    CHECK(sampler.update(true, start));
+    CHECK(sampler.state());
+    CHECK(!sampler.update(false, start + 100ms));
+    CHECK(sampler.pending());
+    CHECK(!sampler.update(false, start + 900ms));
+    CHECK(sampler.update(false, start + 1100ms));
+    CHECK(!sampler.state());
+}
+
+TEST(window_covers_everything_since_the_previous_poll) {
+    sound_sampler_settings settings;
+    settings.off_delay = 2000ms;
+    settings.slow_interval = 5000ms;
+    settings.sample_interval = 100ms;
+    CHECK(sound_sampler(settings).window_depth() == 52);
+
+    // A flip pending on a longer delay is polled on its deadline, so the window has to reach back that far
+    settings.off_delay = 8000ms;
+    CHECK(sound_sampler(settings).window_depth() == 82);
+
+    settings.sample_interval = 0ms;
+    CHECK(sound_sampler(settings).window_depth() == 1);
+}